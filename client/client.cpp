@@ -1,138 +1,536 @@
-#include <dirent.h>
 #include "client.h"
 
-Client::Client(const string& server_address, int port) {
-    this->address_ = server_address.c_str();
+/*!
+ * @brief init client
+ * @param[in] server_address ip address, or "unix:/path/to.sock" and "unix:@name" for a unix socket
+ * @param[in] port
+ * @param[in] options batch size, transport of messages, connections and prefetching
+*/
+Client::Client(const string& server_address, int port, const ClientOptions& options) {
+    this->address_ = server_address;
     this->port_ = port;
+    this->options_ = options;
+
+    // unix sockets stay on the host and are not encrypted
+    if (this->options_.tls_options.is_enabled && !SocketAddress::IsUnix(this->address_)) {
+        this->tls_context_ = TlsContext::Create(this->options_.tls_options, false);
+    }
 }
 
+/*!
+ * @brief send the files of folder to server and pass the responses to the result sink in file order,
+ *        sending starts with the first file found
+ * @param[in] folder_path folder of jpg files
+*/
 void Client::Start(const string& folder_path) {
+    // the files are found while the first batches are sent
+    FileWalker file_walker(this->options_.file_walker_options);
+    file_walker.Start(folder_path);
+
+    this->prefetch_loader_.reset(new PrefetchLoader(
+            file_walker, this->options_.prefetch_thread_count, this->options_.prefetch_depth,
+            [this](const string& file_path, LoadedImage& output) { return this->LoadImage(file_path, output); }));
+
+    this->Run();
+
+    this->prefetch_loader_.reset();
+}
+
+/*!
+ * @brief send the images of a pack file, written by pack-images, as they are stored, without decoding,
+ *        resizing and encoding them, responses are passed to the result sink in pack order
+ * @param[in] pack_path path of pack file
+*/
+void Client::StartPack(const string& pack_path) {
+    this->image_pack_.reset(new ImagePack());
+    if (!this->image_pack_->Open(pack_path, this->options_.is_pack_populated)) {
+        this->image_pack_.reset();
+        return;
+    }
+
+    // the pack holds encoded images only
+    if (this->options_.is_raw_transport) {
+        LOG_WARNING("raw transport is ignored for pack files");
+        this->options_.is_raw_transport = false;
+    }
+
+    LOG_INFO("replaying " << this->image_pack_->GetCount() << " images of " << pack_path);
+
+    this->Run();
+
+    this->image_pack_.reset();
+}
+
+/*!
+ * @brief send batches over the connections and hand the results to the sink until the last file
+*/
+void Client::Run() {
     // record begin time
     auto timestamp_ms_1 = Client::GetCurrentTimestamp();
 
-    int client_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    // raw pixels are sent one Mat per message
+    int batch_size = this->options_.is_raw_transport ? 1 : std::max(this->options_.batch_size, 1);
+    this->options_.batch_size = batch_size;
+
+    this->end_batch_index_ = LONG_MAX;
+    this->next_batch_index_ = 0;
+    this->next_result_index_ = 0;
+    this->map_results_.clear();
+
+    int connection_count = std::max(this->options_.connection_count, 1);
+    this->active_connection_count_ = connection_count;
+
+    // headless unless the caller asks for a sink
+    auto result_sink = this->options_.result_sink;
+    if (!result_sink) {
+        result_sink = make_shared<DiscardSink>();
+    }
+
+    vector<thread> vector_threads;
+    for (int i = 0; i < connection_count; i++) {
+        vector_threads.emplace_back(&Client::ConnectionHandle, this);
+    }
+
+    // hand the results to the sink on this thread, highgui windows belong to the main thread
+    auto i_file_index = 0;
+
+    for (long i_batch = 0; ; i_batch++) {
+        BatchResult result;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_results_);
+            this->cv_results_.wait(lock, [this, i_batch] {
+                return this->map_results_.count(i_batch) > 0 || i_batch >= this->end_batch_index_ ||
+                       this->active_connection_count_ == 0;
+            });
+
+            auto iter = this->map_results_.find(i_batch);
+            if (iter == this->map_results_.end()) {
+                // past the last file, or every connection has gone
+                break;
+            }
+
+            result = std::move(iter->second);
+            this->map_results_.erase(iter);
+            this->next_result_index_ = i_batch + 1;
+        }
+        this->cv_results_.notify_all();
+
+        if (result.is_failed) {
+            LOG_WARNING("batch " << i_batch << " failed");
+            continue;
+        }
+
+        for (size_t i = 0; i < result.vector_mat_image.size(); i++) {
+            result_sink->Put(result.vector_file_index[i], result.vector_file_path[i], result.vector_mat_image[i]);
+
+            LOG_FRAME("# " << i_file_index << " files sent");
+            i_file_index++;
+        }
+    }
+
+    // let connections waiting for the window see the end
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_results_);
+        this->next_result_index_ = LONG_MAX / 2;
+    }
+    this->cv_results_.notify_all();
+
+    for (auto& item : vector_threads) {
+        item.join();
+    }
+
+    result_sink->Finish();
+
+    auto timestamp_ms_2 = Client::GetCurrentTimestamp() - timestamp_ms_1;
+    LOG_INFO("times: " << timestamp_ms_2 / 1000 << " seconds");
+
+    LOG_INFO("done");
+}
+
+/*!
+ * @brief connect a new socket to the server
+ * @return socket file descriptor, -1 means failed
+*/
+int Client::Connect() {
+    bool is_unix = SocketAddress::IsUnix(this->address_);
+
+    int client_fd = socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
 
     if (client_fd == -1) {
         perror("Error: socket");
+        return -1;
     }
 
-    // connect
-    struct sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(this->port_);
-    serverAddr.sin_addr.s_addr = inet_addr(this->address_);
+    // before connect(), the buffer sizes shape the window scale
+    this->options_.socket_options.Apply(client_fd);
 
-    auto is_connected = connect(client_fd, (struct sockaddr *)& serverAddr, sizeof(serverAddr));
+    // connect
+    int is_connected;
+    if (is_unix) {
+        struct sockaddr_un serverAddr{};
+        socklen_t serverAddrLen = SocketAddress::MakeUnix(this->address_, serverAddr);
+
+        is_connected = serverAddrLen == 0 ? -1 : connect(client_fd, (struct sockaddr *)& serverAddr, serverAddrLen);
+    } else {
+        struct sockaddr_in serverAddr{};
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(this->port_);
+        serverAddr.sin_addr.s_addr = inet_addr(this->address_.c_str());
+
+        is_connected = connect(client_fd, (struct sockaddr *)& serverAddr, sizeof(serverAddr));
+    }
     if (is_connected < 0) {
         perror("Error: connect");
+        close(client_fd);
+        return -1;
     }
 
-    // target image list
-    vector<string> vector_filename_list;
-    // load and fill the path of files to vector
-    GetFileList(folder_path, vector_filename_list);
+    return client_fd;
+}
+
+/*!
+ * @brief thread of one connection, takes the next batch until every batch is sent
+*/
+void Client::ConnectionHandle() {
+    int client_fd = this->Connect();
+    bool is_unix_address = SocketAddress::IsUnix(this->address_);
+
+    if (client_fd != -1) {
+        Message message(client_fd, this->address_);
+        message.SetQuickAck(this->options_.socket_options.is_quick_ack);
+
+        // the handshake comes before any frame, a connection without it sends nothing
+        bool is_secured = !this->options_.tls_options.is_enabled || is_unix_address ||
+                          (this->tls_context_ && message.StartTls(this->tls_context_));
+        if (!is_secured) {
+            LOG_WARNING("TLS handshake with " << this->address_ << " failed");
+        }
+
+        if (is_secured && this->options_.is_zero_copy) {
+            message.SetZeroCopy(true);
+        }
 
-    long i_file_count = vector_filename_list.size();
+        // fall back to the socket if the server cannot map our shared memory
+        if (is_secured && this->options_.is_shm_transport) {
+            message.RequestShm(this->options_.shm_capacity);
+        }
 
-//    std::vector<int> imencode_params;
-//    imencode_params.push_back(cv::IMWRITE_JPEG_QUALITY);
-//    imencode_params.push_back(100);
+        // an old server without "control/encode" would not answer, so ask only for non-default params
+        if (is_secured && this->options_.encode_params.ToJson() != EncodeParams().ToJson()) {
+            message.RequestEncodeParams(this->options_.encode_params);
+        }
 
-    auto message = Message(client_fd, this->address_);
+        // a server without "control/compress" would not answer either
+        if (is_secured && !this->options_.content_encodings.empty()) {
+            message.RequestContentEncoding(this->options_.content_encodings, this->options_.compression_level);
+        }
 
-    auto i_file_index = 0;
+        // batches in flight or waiting to be shown, per connection
+        long window = 2 * std::max(this->options_.connection_count, 1);
 
-    // resize our input images to fit with model
-    cv::Size dSize = cv::Size(800, 800);
+        while (is_secured) {
+            long batch_index = this->next_batch_index_++;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex_results_);
+                this->cv_results_.wait(lock, [this, batch_index, window] {
+                    return batch_index < this->next_result_index_ + window || batch_index >= this->end_batch_index_;
+                });
+
+                if (batch_index >= this->end_batch_index_) {
+                    break;
+                }
+            }
 
-    for (const auto& image_path : vector_filename_list) {
-        // load image from file path, the size of image maybe w:2050 h:2411
-        Mat mat_temp = imread(image_path, IMREAD_COLOR);
+            BatchResult result;
+            bool is_connected = this->SendBatch(message, batch_index, result);
 
-        // define a new Mat object with w:800 h:800
-        Mat mat_image(dSize, CV_32F);
+            // nothing to put for a batch past the last file
+            if (batch_index >= this->end_batch_index_) {
+                break;
+            }
+            this->PutResult(batch_index, result);
+
+            if (!is_connected) {
+                break;
+            }
+        }
+
+        shutdown(client_fd, SHUT_RDWR);
+        close(client_fd);
+    }
+
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_results_);
+        this->active_connection_count_--;
+    }
+    this->cv_results_.notify_all();
+}
 
-        // resize input image, from w:2050 h:2411 to w:800 h:800
-        resize(mat_temp, mat_image, dSize, INTER_LINEAR);
+/*!
+ * @brief send the files, or pack images, of one batch and decode the response
+ * @param[in] message Message of the connection
+ * @param[in] batch_index index of the batch
+ * @param[out] result decoded responses
+ * @return true=the connection works, false=socket error or the batch could not be written
+*/
+bool Client::SendBatch(Message& message, long batch_index, BatchResult& result) {
+    // batches take turns over the streams, e.g. one file per camera with a batch size of 1
+    long stream_count = std::max(this->options_.stream_count, 1);
+    long stream_id = stream_count > 1 ? batch_index % stream_count + 1 : 0;
+
+    message.Clear();
+    message.SetStreamId(stream_id);
+    message.SetPriority(this->options_.priority);
+    bool is_written = this->image_pack_ ? this->WritePackBatch(message, batch_index, result) :
+                                          this->WriteFileBatch(message, batch_index, result);
+
+    // nothing went out, e.g. encoding failed or the batch exceeds the frame size, so no answer comes either,
+    // the connection is given up rather than waiting for it
+    if (!is_written) {
+        LOG_WARNING("failed to write batch " << batch_index << " to server " << this->address_);
+        result.is_failed = true;
+        return false;
+    }
 
-        // release the image matrix from imread
-        mat_temp.release();
+    // every file of the batch failed to load, nothing to send
+    if (result.vector_file_index.empty()) {
+        return true;
+    }
 
-        message.Clear();
-        message.WriteImage(mat_image);
+    unsigned char *output_buffer;
+    long output_length = 0;
 
-        unsigned char *output_buffer;
-        long output_length = 0;
+    // if the socket works well
+    if (!message.Read()) {
+        result.is_failed = true;
+        return false;
+    }
 
-        // if the socket works well
-        if (message.Read()) {
+    message.GetImageBufferResult(output_buffer, output_length);
 
-            message.GetImageBufferResult(output_buffer, output_length);
+    // a server serving live streams drops frames it can not process in time, such a batch has no images
+    if (!message.GetStatus().empty()) {
+        LOG_FRAME("# batch " << batch_index << " of stream " << stream_id << " is " << message.GetStatus());
 
-            if (output_length > 0) {
+        result.vector_file_index.clear();
+        result.vector_file_path.clear();
+        return true;
+    }
 
-                std::vector<uchar> vector_image(output_buffer, output_buffer + output_length);
+    // a server without streams answers on stream 0
+    if (message.GetStreamId() != stream_id) {
+        LOG_WARNING("response of stream " << message.GetStreamId() << " to a request of stream " << stream_id);
+    }
 
-                cout << "# received " << output_length << " bytes from server " << this->address_ << endl;
+    cv::Mat mat_raw;
 
-                cv::Mat mat_image_show;
-                cv::imdecode(vector_image, cv::ImreadModes::IMREAD_COLOR, &mat_image_show);
+    if (message.GetMatResult(mat_raw)) {
 
-                cv::imshow("client", mat_image_show);
-                cv::waitKey(1);
+        LOG_FRAME("# received " << output_length << " bytes from server " << this->address_);
 
-                mat_image_show.release();
+        // the received pixels are overwritten by the next message of this connection
+        result.vector_mat_image.push_back(mat_raw.clone());
+        result.vector_file_index.resize(1);
+        result.vector_file_path.resize(1);
 
-                // release vector
-                vector_image.clear();
-                vector<uchar>().swap(vector_image);
+    } else if (output_length > 0) {
 
-                cout << "# " << i_file_index << " / " << i_file_count << " files sent" << endl;
-                i_file_index++;
-            }
-        } else {
+        LOG_FRAME("# received " << output_length << " bytes from server " << this->address_);
+
+        // a response with fewer images than requested keeps the first file indices
+        result.vector_mat_image.resize(std::min<size_t>(message.GetImageCount(), result.vector_file_index.size()));
+        result.vector_file_index.resize(result.vector_mat_image.size());
+        result.vector_file_path.resize(result.vector_mat_image.size());
+
+        for (size_t i = 0; i < result.vector_mat_image.size(); i++) {
+            message.GetImageBufferResult(i, output_buffer, output_length);
+            ImageCodec::Decode(output_buffer, output_length, result.vector_mat_image[i]);
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * @brief load the files of one batch and write them as a message
+ * @param[in] message Message of the connection
+ * @param[in] batch_index index of the batch
+ * @param[out] result index and path of the files sent
+ * @return true=written or nothing to write, false=failed
+*/
+bool Client::WriteFileBatch(Message& message, long batch_index, BatchResult& result) {
+    long i_file_begin = batch_index * this->options_.batch_size;
+    long i_file_end = i_file_begin + this->options_.batch_size;
+
+    // images of the current batch
+    vector<LoadedImage> vector_images;
+
+    for (long i_file = i_file_begin; i_file < i_file_end; i_file++) {
+        LoadedImage image;
+        string file_path;
+
+        auto status = this->prefetch_loader_->Take(i_file, image, file_path);
+        if (status == PrefetchLoader::TakeStatus::End) {
+            // this batch is the last one, or already past the last file
+            this->SetEndBatch(i_file == i_file_begin ? batch_index : batch_index + 1);
             break;
         }
 
-        mat_image.release();
+        if (status == PrefetchLoader::TakeStatus::Loaded) {
+            vector_images.push_back(std::move(image));
+            result.vector_file_index.push_back(i_file);
+            result.vector_file_path.push_back(file_path);
+        }
+    }
 
-        usleep(1);
+    if (vector_images.empty()) {
+        return true;
     }
 
-//    imencode_params.clear();
-//    vector<int>().swap(imencode_params);
+    bool is_all_encoded = std::all_of(vector_images.begin(), vector_images.end(),
+                                      [](const LoadedImage& image) { return image.IsEncoded(); });
 
-    auto timestamp_ms_2 = Client::GetCurrentTimestamp() - timestamp_ms_1;
-    cout << "times: " << timestamp_ms_2 / 1000 << " seconds" << endl;
+    // files of the target size go out as they were read
+    if (is_all_encoded) {
+        vector<iovec> vector_iov;
+        for (auto& image : vector_images) {
+            vector_iov.push_back({image.vector_encoded.data(), image.vector_encoded.size()});
+        }
+
+        return message.WriteEncodedImages(vector_iov.data(), vector_iov.size(), this->options_.batch_size > 1);
+    }
 
-    shutdown(client_fd, SHUT_RDWR);
+    // a batch mixing both is encoded as a whole, rare enough to decode the passed-through files here
+    vector<cv::Mat> vector_mat_image(vector_images.size());
+    for (size_t i = 0; i < vector_images.size(); i++) {
+        auto& image = vector_images[i];
 
-    cout << "done" << endl;
+        if (image.IsEncoded()) {
+            ImageCodec::Decode(image.vector_encoded.data(), image.vector_encoded.size(), vector_mat_image[i]);
+        } else {
+            vector_mat_image[i] = image.mat_image;
+        }
+    }
+
+    if (this->options_.is_raw_transport) {
+        return message.WriteMat(vector_mat_image[0]);
+    } else if (this->options_.batch_size > 1) {
+        return message.WriteImages(vector_mat_image);
+    } else {
+        return message.WriteImage(vector_mat_image[0]);
+    }
 }
 
 /*!
- * @brief load and fill the path of files to vector
- * @param[in] path folder path
- * @param[out] vector_filename vector of filename
+ * @brief write the images of one batch straight from the mapped pack file
+ * @param[in] message Message of the connection
+ * @param[in] batch_index index of the batch
+ * @param[out] result index and name of the images sent
+ * @return true=written or nothing to write, false=failed
 */
-void Client::GetFileList(const string& path, vector<string>& vector_filename) {
-    DIR *pDir;
-    struct dirent *ptr;
-    if (!(pDir = opendir(path.c_str()))) {
-        cout << "Folder doesn't Exist!" << endl;
-        return;
+bool Client::WritePackBatch(Message& message, long batch_index, BatchResult& result) {
+    long image_count = this->image_pack_->GetCount();
+    long i_file_begin = batch_index * this->options_.batch_size;
+    long i_file_end = std::min(i_file_begin + this->options_.batch_size, image_count);
+
+    // the count is known up front, so the end is set by the batch holding the last image
+    if (i_file_end >= image_count) {
+        this->SetEndBatch(i_file_begin < image_count ? batch_index + 1 : batch_index);
     }
-    while ((ptr = readdir(pDir)) != nullptr) {
-        if (strstr(ptr->d_name, ".jpg") != nullptr) {
-            vector_filename.push_back(path + "/" + ptr->d_name);
+
+    // pointers into the mapping, sent without a copy unless the message goes through a memfd
+    vector<iovec> vector_iov;
+
+    for (long i_file = i_file_begin; i_file < i_file_end; i_file++) {
+        const unsigned char* data;
+        long length;
+
+        if (this->image_pack_->Get(i_file, data, length)) {
+            vector_iov.push_back({(void*) data, (size_t) length});
+            result.vector_file_index.push_back(i_file);
+            result.vector_file_path.push_back(this->image_pack_->GetName(i_file));
         }
     }
-    //排序
-    sort(vector_filename.begin(), vector_filename.end());
 
-    closedir(pDir);
+    return vector_iov.empty() ||
+           message.WriteEncodedImages(vector_iov.data(), vector_iov.size(), this->options_.batch_size > 1);
+}
+
+/*!
+ * @brief hand a finished batch to the thread showing results
+ * @param[in] batch_index index of the batch
+ * @param[in,out] result responses, moved out
+*/
+void Client::PutResult(long batch_index, BatchResult& result) {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_results_);
+        this->map_results_[batch_index] = std::move(result);
+    }
+    this->cv_results_.notify_all();
+}
+
+/*!
+ * @brief record the first batch past the last file, connections and the result loop stop there
+ * @param[in] batch_index index of the batch
+*/
+void Client::SetEndBatch(long batch_index) {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_results_);
+        this->end_batch_index_ = std::min(this->end_batch_index_.load(), batch_index);
+    }
+    this->cv_results_.notify_all();
 }
 
+/*!
+ * @brief read one file and resize it to the model input, a jpg which already has that size is kept encoded
+ * @param[in] file_path path of image file
+ * @param[out] output resized image, or the file contents
+ * @return true=succeed, false=failed to read
+*/
+bool Client::LoadImage(const string& file_path, LoadedImage& output) const {
+    // resize our input images to fit with model
+    const cv::Size& dSize = this->options_.target_size;
+
+    // decode only as many pixels as the resize keeps, e.g. 1/2 of w:2050 h:2411 still covers w:800 h:800
+    DecodeOptions decode_options = this->options_.decode_options;
+    if (decode_options.target_size.empty()) {
+        decode_options.target_size = dSize;
+    }
+
+    // file contents, moved to output when the file is sent as it is
+    static thread_local vector<unsigned char> vector_file;
+
+    if (!ImageCodec::ReadFile(file_path, vector_file)) {
+        return false;
+    }
+
+    // the SOF marker tells the size without decoding, raw pixels and cropped files always need the pixels
+    int width = 0;
+    int height = 0;
+    if (this->options_.is_passthrough && !this->options_.is_raw_transport && decode_options.roi.empty() &&
+        ImageCodec::GetJpegSize(vector_file.data(), vector_file.size(), width, height) &&
+        cv::Size(width, height) == dSize) {
+
+        output.vector_encoded = std::move(vector_file);
+        vector_file.clear();
+        return true;
+    }
+
+    // decode the file, the size of image maybe w:2050 h:2411, decoded at w:1025 h:1206
+    Mat mat_temp;
+    if (!ImageCodec::Decode(vector_file.data(), vector_file.size(), decode_options, mat_temp)) {
+        return false;
+    }
+
+    // resize input image, from w:1025 h:1206 to w:800 h:800, cv::resize allocates output.mat_image with the type of the input
+    if (mat_temp.size() == dSize) {
+        output.mat_image = mat_temp;
+    } else {
+        resize(mat_temp, output.mat_image, dSize, 0, 0, this->options_.interpolation);
+    }
+
+    return true;
+}
 
 /*!
  * @brief get current time ticks
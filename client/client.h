@@ -8,9 +8,19 @@
 #include <arpa/inet.h>
 #include <opencv2/opencv.hpp>
 #include <mutex>
+#include <condition_variable>
+#include <map>
+#include <climits>
 
 #include "json.hpp"
 #include "message.h"
+#include "file_walker.h"
+#include "image_pack.h"
+#include "prefetch_loader.h"
+#include "result_sink.h"
+#include "socket_address.h"
+#include "socket_options.h"
+#include "tls_session.h"
 
 using namespace std;
 using namespace cv;
@@ -20,23 +30,153 @@ using namespace std::chrono;
 #ifndef CLIENT_CLIENT_H
 #define CLIENT_CLIENT_H
 
+// options of Client, defaults keep one jpg image per message
+struct ClientOptions {
+    // count of images per message, > 1 sends "binary/image-batch" messages
+    int batch_size = 1;
+
+    // send raw pixels as "binary/mat" instead of jpg, for same-host or high bandwidth links
+    bool is_raw_transport = false;
+
+    // carry frames through shared memory when the server runs on the same host
+    bool is_shm_transport = false;
+
+    // bytes of each direction's shared memory ring
+    long shm_capacity = 64 * 1024 * 1024;
+
+    // encoding of the requests, the server is asked to encode its responses the same way
+    EncodeParams encode_params;
+
+    // TCP_NODELAY, buffer sizes, quick acks and busy polling of the connections
+    SocketOptions socket_options;
+
+    // send large requests, e.g. raw frames, with MSG_ZEROCOPY
+    bool is_zero_copy = false;
+
+    // encrypt tcp connections, set tls_options.ca_path to verify the server
+    TlsOptions tls_options;
+
+    // compress "text/json" and "binary/tensor" contents of both sides with the first of these the server supports,
+    // e.g. {"zstd", "lz4"}, empty = uncompressed
+    vector<string> content_encodings;
+
+    // level of the compression, 0 = the library default
+    int compression_level = 0;
+
+    // input size of the server's model, every image is resized to it
+    cv::Size target_size{800, 800};
+
+    // cv::resize() interpolation, e.g. INTER_AREA when most files are much larger than target_size
+    int interpolation = cv::INTER_LINEAR;
+
+    // send jpg files which already have target_size as they are, without decoding and encoding them again
+    bool is_passthrough = true;
+
+    // scaled / cropped decode of the input files, an empty target_size means the target_size above
+    DecodeOptions decode_options;
+
+    // which files of the folder are sent, and in which order
+    FileWalkerOptions file_walker_options;
+
+    // count of connections sending batches in parallel, results are still shown in file order
+    int connection_count = 1;
+
+    // count of logical streams, e.g. cameras, the batches of each connection take turns over streams 1..stream_count,
+    // 1 sends every batch without a stream like before
+    int stream_count = 1;
+
+    // priority class the server processes the streams of this client by, "critical", "normal" or "bulk",
+    // empty = the server's default
+    string priority;
+
+    // count of threads reading and resizing files ahead of the senders, 0 = each sender loads its own files
+    int prefetch_thread_count = 0;
+
+    // most files loaded ahead of the senders
+    int prefetch_depth = 16;
+
+    // StartPack() faults the whole pack file in before sending, so no send waits for the disk
+    bool is_pack_populated = false;
+
+    // receives the responses in file order, nullptr = DiscardSink, use DisplaySink to show them
+    shared_ptr<ResultSink> result_sink;
+};
+
 
 class Client {
 
 public:
 
-    Client(const string& server_address, int port);
+    Client(const string& server_address, int port, const ClientOptions& options = ClientOptions());
 
     void Start(const string& folder_path);
 
+    void StartPack(const string& pack_path);
+
 private:
-    // host address
-    const char *address_;
+    // responses of one batch, in the order of its files
+    struct BatchResult {
+        vector<cv::Mat> vector_mat_image;
+        // index and path of the request file of each image
+        vector<long> vector_file_index;
+        vector<string> vector_file_path;
+        bool is_failed = false;
+    };
+
+    // host address, or unix socket endpoint
+    string address_;
 
     //port number
     int port_;
 
-    static void GetFileList(const string& path, vector<string>& vector_filename);
+    ClientOptions options_;
+
+    // nullptr when TLS is off
+    shared_ptr<TlsContext> tls_context_;
+
+    // files of the current Start() are split into batches of options_.batch_size as they are found,
+    // the first batch past the last file, unknown until the walker ends, written under mutex_results_ but also
+    // read by connections without it
+    atomic<long> end_batch_index_{LONG_MAX};
+
+    // index of the next batch a connection takes
+    atomic<long> next_batch_index_{0};
+
+    unique_ptr<PrefetchLoader> prefetch_loader_;
+
+    // set by StartPack(), its images are sent as they are instead of the files of prefetch_loader_
+    unique_ptr<ImagePack> image_pack_;
+
+    // finished batches wait here until every batch before them is shown
+    map<long, BatchResult> map_results_;
+
+    // index of the next batch to show
+    long next_result_index_ = 0;
+
+    // connections still sending, when it drops to 0 no more results arrive
+    int active_connection_count_ = 0;
+
+    mutex mutex_results_;
+
+    condition_variable cv_results_;
+
+    void Run();
+
+    int Connect();
+
+    void ConnectionHandle();
+
+    bool SendBatch(Message& message, long batch_index, BatchResult& result);
+
+    bool WriteFileBatch(Message& message, long batch_index, BatchResult& result);
+
+    bool WritePackBatch(Message& message, long batch_index, BatchResult& result);
+
+    void PutResult(long batch_index, BatchResult& result);
+
+    void SetEndBatch(long batch_index);
+
+    bool LoadImage(const string& file_path, LoadedImage& output) const;
 
     // get current time ticks
     static long GetCurrentTimestamp();
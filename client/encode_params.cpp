@@ -0,0 +1,193 @@
+#include "encode_params.h"
+
+#include <algorithm>
+#include <cmath>
+#include <opencv2/opencv.hpp>
+
+namespace {
+    /*!
+     * @brief read a number field of a peer's json, clamped to a range
+     * @param[in] json_object json object
+     * @param[in] key name of the field
+     * @param[in] value used when the field is missing or not a number
+     * @param[in] min_value smallest result
+     * @param[in] max_value largest result
+     * @return the field, clamped
+    */
+    int GetClampedInt(const json& json_object, const char* key, int value, int min_value, int max_value) {
+        auto iter = json_object.find(key);
+        if (iter != json_object.end() && iter->is_number()) {
+            // clamped as double first, a huge number does not fit an int
+            value = (int) std::min(std::max(iter->get<double>(), (double) min_value), (double) max_value);
+        }
+        return std::min(std::max(value, min_value), max_value);
+    }
+
+    /*!
+     * @brief read a boolean field of a peer's json
+     * @param[in] json_object json object
+     * @param[in] key name of the field
+     * @param[in] value returned when the field is missing or not a boolean
+     * @return the field
+    */
+    bool GetBool(const json& json_object, const char* key, bool value) {
+        auto iter = json_object.find(key);
+        return iter != json_object.end() && iter->is_boolean() ? iter->get<bool>() : value;
+    }
+}
+
+/*!
+ * @brief convert to the params of cv::imencode
+ * @param[in] encode_quality quality to use, may be lowered by AdaptiveQuality
+ * @return params of cv::imencode
+*/
+vector<int> EncodeParams::ToImencodeParams(int encode_quality) const {
+    vector<int> imencode_params;
+
+    if (this->format == ".jpg" || this->format == ".jpeg") {
+        imencode_params.push_back(cv::IMWRITE_JPEG_QUALITY);
+        imencode_params.push_back(encode_quality);
+
+        imencode_params.push_back(cv::IMWRITE_JPEG_OPTIMIZE);
+        imencode_params.push_back(this->is_optimize ? 1 : 0);
+
+        imencode_params.push_back(cv::IMWRITE_JPEG_PROGRESSIVE);
+        imencode_params.push_back(this->is_progressive ? 1 : 0);
+
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 6)
+        int sampling_factor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_420;
+        switch (this->chroma_subsampling) {
+            case 444: sampling_factor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_444; break;
+            case 422: sampling_factor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_422; break;
+            case 411: sampling_factor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_411; break;
+            case 440: sampling_factor = cv::IMWRITE_JPEG_SAMPLING_FACTOR_440; break;
+            default: break;
+        }
+        imencode_params.push_back(cv::IMWRITE_JPEG_SAMPLING_FACTOR);
+        imencode_params.push_back(sampling_factor);
+#endif
+    } else if (this->format == ".webp") {
+        imencode_params.push_back(cv::IMWRITE_WEBP_QUALITY);
+        imencode_params.push_back(encode_quality);
+    } else if (this->format == ".png") {
+        // fastest compression, png is lossless anyway
+        imencode_params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+        imencode_params.push_back(1);
+    }
+
+    return imencode_params;
+}
+
+/*!
+ * @brief convert to the json fields of a "control/encode" message
+ * @return json object
+*/
+json EncodeParams::ToJson() const {
+    json json_object;
+    json_object["format"] = this->format;
+    json_object["quality"] = this->quality;
+    json_object["chroma-subsampling"] = this->chroma_subsampling;
+    json_object["optimize"] = this->is_optimize;
+    json_object["progressive"] = this->is_progressive;
+    json_object["adaptive"] = this->is_adaptive;
+    json_object["min-quality"] = this->min_quality;
+    json_object["target-fps"] = this->target_fps;
+    return json_object;
+}
+
+/*!
+ * @brief read the json fields of a "control/encode" message, missing or bad fields keep their defaults,
+ *        numbers out of range are clamped
+ * @param[in] json_object json object
+ * @return EncodeParams
+*/
+EncodeParams EncodeParams::FromJson(const json& json_object) {
+    EncodeParams params;
+
+    // the fields come from the peer, each is checked for its type before it is read
+    auto iter = json_object.find("format");
+    if (iter != json_object.end() && iter->is_string()) {
+        const auto& format = iter->get_ref<const string&>();
+        if (format == ".jpg" || format == ".jpeg" || format == ".png" || format == ".webp") {
+            params.format = format;
+        }
+    }
+
+    params.quality = GetClampedInt(json_object, "quality", params.quality, 1, 100);
+
+    // only the samplings ToImencodeParams() knows, so the answer tells what is encoded
+    iter = json_object.find("chroma-subsampling");
+    if (iter != json_object.end() && iter->is_number_integer()) {
+        auto chroma_subsampling = iter->get<long>();
+        if (chroma_subsampling == 444 || chroma_subsampling == 422 || chroma_subsampling == 420 ||
+            chroma_subsampling == 411 || chroma_subsampling == 440) {
+            params.chroma_subsampling = (int) chroma_subsampling;
+        }
+    }
+
+    params.is_optimize = GetBool(json_object, "optimize", params.is_optimize);
+    params.is_progressive = GetBool(json_object, "progressive", params.is_progressive);
+    params.is_adaptive = GetBool(json_object, "adaptive", params.is_adaptive);
+    params.min_quality = GetClampedInt(json_object, "min-quality", params.min_quality, 1, params.quality);
+
+    iter = json_object.find("target-fps");
+    if (iter != json_object.end() && iter->is_number()) {
+        auto target_fps = iter->get<double>();
+        if (target_fps > 0 && std::isfinite(target_fps)) {
+            params.target_fps = target_fps;
+        }
+    }
+
+    return params;
+}
+
+/*!
+ * @brief start from the quality of params
+ * @param[in] params encode params
+*/
+void AdaptiveQuality::Reset(const EncodeParams& params) {
+    this->is_enabled_ = params.is_adaptive && params.target_fps > 0;
+    this->quality_ = params.quality;
+    this->max_quality_ = params.quality;
+    this->min_quality_ = std::min(params.min_quality, params.quality);
+    this->budget_ms_ = params.target_fps > 0 ? 1000.0 / params.target_fps : 0;
+    this->average_ms_ = 0;
+}
+
+/*!
+ * @brief get the quality for the next frame
+ * @return quality
+*/
+int AdaptiveQuality::GetQuality() const {
+    return this->quality_;
+}
+
+/*!
+ * @brief record the time of one frame, lower quality fast when over budget and raise it slowly when well under
+ * @param[in] frame_ms time of encoding and sending one frame
+ * @return true=quality changed
+*/
+bool AdaptiveQuality::Update(double frame_ms) {
+    if (!this->is_enabled_) {
+        return false;
+    }
+
+    if (this->average_ms_ == 0) {
+        this->average_ms_ = frame_ms;
+    } else {
+        this->average_ms_ = AdaptiveQuality::average_weight_ * frame_ms +
+                            (1 - AdaptiveQuality::average_weight_) * this->average_ms_;
+    }
+
+    int quality = this->quality_;
+
+    if (this->average_ms_ > this->budget_ms_) {
+        quality = std::max(quality - AdaptiveQuality::lower_step_, this->min_quality_);
+    } else if (this->average_ms_ < this->budget_ms_ * AdaptiveQuality::raise_ratio_) {
+        quality = std::min(quality + AdaptiveQuality::raise_step_, this->max_quality_);
+    }
+
+    bool is_changed = quality != this->quality_;
+    this->quality_ = quality;
+    return is_changed;
+}
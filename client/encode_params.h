@@ -0,0 +1,78 @@
+#ifndef CLIENT_ENCODE_PARAMS_H
+#define CLIENT_ENCODE_PARAMS_H
+
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// how images are encoded before they are sent, negotiated per connection with a "control/encode" message
+struct EncodeParams {
+    // extension passed to cv::imencode, ".jpg", ".png" or ".webp"
+    string format = ".jpg";
+
+    // 1-100, ".jpg" and ".webp" only
+    int quality = 100;
+
+    // 444, 422, 420, 411 or 440, ".jpg" only
+    int chroma_subsampling = 420;
+
+    bool is_optimize = false;
+
+    bool is_progressive = false;
+
+    // lower quality down to min_quality while a frame takes longer than 1000 / target_fps ms
+    bool is_adaptive = false;
+
+    int min_quality = 50;
+
+    double target_fps = 30;
+
+    vector<int> ToImencodeParams(int encode_quality) const;
+
+    json ToJson() const;
+
+    static EncodeParams FromJson(const json& json_object);
+};
+
+
+// adjusts the quality of EncodeParams from the measured time of encoding and sending each frame
+class AdaptiveQuality {
+
+public:
+    void Reset(const EncodeParams& params);
+
+    int GetQuality() const;
+
+    bool Update(double frame_ms);
+
+private:
+
+    // weight of the latest frame in the moving average
+    constexpr static const double average_weight_ = 0.2;
+
+    // raise quality again only when frames take less than this share of the budget
+    constexpr static const double raise_ratio_ = 0.7;
+
+    static const int lower_step_ = 5;
+
+    static const int raise_step_ = 1;
+
+    bool is_enabled_ = false;
+
+    int quality_ = 100;
+
+    int min_quality_ = 50;
+
+    int max_quality_ = 100;
+
+    double budget_ms_ = 0;
+
+    double average_ms_ = 0;
+};
+
+#endif //CLIENT_ENCODE_PARAMS_H
@@ -0,0 +1,230 @@
+#include "file_walker.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <fstream>
+#include <strings.h>
+#include <sys/stat.h>
+
+/*!
+ * @brief init FileWalker
+ * @param[in] options filters, recursion and manifest
+*/
+FileWalker::FileWalker(const FileWalkerOptions& options) {
+    this->options_ = options;
+}
+
+/*!
+ * @brief stop the walk
+*/
+FileWalker::~FileWalker() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_paths_);
+        this->is_stopped_ = true;
+    }
+    this->cv_popped_.notify_all();
+
+    if (this->thread_walker_.joinable()) {
+        this->thread_walker_.join();
+    }
+}
+
+/*!
+ * @brief start walking folder_path, or reading the manifest, on the background thread
+ * @param[in] folder_path folder of files
+*/
+void FileWalker::Start(const string& folder_path) {
+    this->thread_walker_ = thread(&FileWalker::WalkHandle, this, folder_path);
+}
+
+/*!
+ * @brief wait for the next path
+ * @param[out] file_path path of file
+ * @return true=got a path, false=every path has been handed out
+*/
+bool FileWalker::Next(string& file_path) {
+    std::unique_lock<std::mutex> lock(this->mutex_paths_);
+    this->cv_pushed_.wait(lock, [this] { return !this->deque_paths_.empty() || this->is_finished_; });
+
+    if (this->deque_paths_.empty()) {
+        return false;
+    }
+
+    file_path = std::move(this->deque_paths_.front());
+    this->deque_paths_.pop_front();
+    lock.unlock();
+
+    this->cv_popped_.notify_one();
+    return true;
+}
+
+/*!
+ * @brief walker thread
+ * @param[in] folder_path folder of files
+*/
+void FileWalker::WalkHandle(const string& folder_path) {
+    if (this->options_.manifest_path.empty()) {
+        this->WalkFolder(folder_path);
+    } else {
+        this->ReadManifest(folder_path);
+    }
+
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_paths_);
+        this->is_finished_ = true;
+    }
+    this->cv_pushed_.notify_all();
+}
+
+/*!
+ * @brief walk folders depth first, each folder is read in one pass of readdir
+ * @param[in] folder_path root folder
+*/
+void FileWalker::WalkFolder(const string& folder_path) {
+    vector<string> vector_folders(1, folder_path);
+
+    while (!vector_folders.empty()) {
+        string folder = std::move(vector_folders.back());
+        vector_folders.pop_back();
+
+        DIR *pDir;
+        if (!(pDir = opendir(folder.c_str()))) {
+            LOG_ERROR("Folder doesn't Exist! " << folder);
+            continue;
+        }
+
+        // files of this folder when they are sorted before emitting
+        vector<string> vector_files;
+        vector<string> vector_sub_folders;
+
+        struct dirent *ptr;
+        while ((ptr = readdir(pDir)) != nullptr) {
+            if (strcmp(ptr->d_name, ".") == 0 || strcmp(ptr->d_name, "..") == 0) {
+                continue;
+            }
+
+            string path = folder + "/" + ptr->d_name;
+
+            // some file systems do not fill d_type
+            auto d_type = ptr->d_type;
+            if (d_type == DT_UNKNOWN || d_type == DT_LNK) {
+                struct stat path_stat{};
+                if (stat(path.c_str(), &path_stat) == -1) {
+                    continue;
+                }
+                if (S_ISDIR(path_stat.st_mode)) {
+                    // a link to a folder may point back up the tree
+                    d_type = ptr->d_type == DT_LNK ? DT_LNK : DT_DIR;
+                } else {
+                    d_type = S_ISREG(path_stat.st_mode) ? DT_REG : DT_UNKNOWN;
+                }
+            }
+
+            if (d_type == DT_DIR) {
+                if (this->options_.is_recursive) {
+                    vector_sub_folders.push_back(std::move(path));
+                }
+            } else if (d_type == DT_REG && this->IsMatched(ptr->d_name)) {
+                if (this->options_.is_sorted) {
+                    vector_files.push_back(std::move(path));
+                } else if (!this->Push(path)) {
+                    closedir(pDir);
+                    return;
+                }
+            }
+        }
+        closedir(pDir);
+
+        sort(vector_files.begin(), vector_files.end());
+        for (const auto& path : vector_files) {
+            if (!this->Push(path)) {
+                return;
+            }
+        }
+
+        // the stack pops the last one first, reverse to walk sub folders in name order
+        if (this->options_.is_sorted) {
+            sort(vector_sub_folders.rbegin(), vector_sub_folders.rend());
+        }
+        for (auto& path : vector_sub_folders) {
+            vector_folders.push_back(std::move(path));
+        }
+    }
+}
+
+/*!
+ * @brief emit the paths of the manifest file, empty lines and lines starting with '#' are skipped
+ * @param[in] folder_path folder of relative paths
+*/
+void FileWalker::ReadManifest(const string& folder_path) {
+    std::ifstream manifest(this->options_.manifest_path);
+    if (!manifest) {
+        LOG_ERROR("Manifest doesn't Exist! " << this->options_.manifest_path);
+        return;
+    }
+
+    string line;
+    while (std::getline(manifest, line)) {
+        // tolerate manifests written on windows
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        if (!this->Push(line[0] == '/' ? line : folder_path + "/" + line)) {
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief check the name of a file against the extensions and the glob
+ * @param[in] file_name name of file without folder
+ * @return true=the file is kept
+*/
+bool FileWalker::IsMatched(const string& file_name) const {
+    if (!this->options_.name_pattern.empty() &&
+        fnmatch(this->options_.name_pattern.c_str(), file_name.c_str(), 0) != 0) {
+        return false;
+    }
+
+    if (this->options_.extensions.empty()) {
+        return true;
+    }
+
+    for (const auto& extension : this->options_.extensions) {
+        if (file_name.size() >= extension.size() &&
+            strcasecmp(file_name.c_str() + file_name.size() - extension.size(), extension.c_str()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief queue a path, waits while max_queue_length_ paths are queued
+ * @param[in] file_path path of file
+ * @return true=queued, false=the walker is stopped
+*/
+bool FileWalker::Push(const string& file_path) {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_paths_);
+        this->cv_popped_.wait(lock, [this] {
+            return this->is_stopped_ || this->deque_paths_.size() < FileWalker::max_queue_length_;
+        });
+
+        if (this->is_stopped_) {
+            return false;
+        }
+
+        this->deque_paths_.push_back(file_path);
+    }
+    this->cv_pushed_.notify_one();
+    return true;
+}
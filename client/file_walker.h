@@ -0,0 +1,76 @@
+#ifndef CLIENT_FILE_WALKER_H
+#define CLIENT_FILE_WALKER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// which files of a folder are sent, defaults keep the jpg files directly inside the folder
+struct FileWalkerOptions {
+    // walk sub folders too, symbolic links to folders are not followed
+    bool is_recursive = false;
+
+    // kept file extensions, compared case-insensitively, empty keeps every file
+    vector<string> extensions{".jpg"};
+
+    // fnmatch() glob on the file name, e.g. "0000*", empty keeps every name
+    string name_pattern;
+
+    // file with one path per line, read instead of walking the folder, relative paths are below the folder
+    string manifest_path;
+
+    // sort the files of each folder by name, a folder is only emitted after it was read completely
+    bool is_sorted = false;
+};
+
+
+// enumerates files on a background thread, paths are handed out while the walk goes on
+class FileWalker {
+
+public:
+    explicit FileWalker(const FileWalkerOptions& options = FileWalkerOptions());
+
+    ~FileWalker();
+
+    void Start(const string& folder_path);
+
+    bool Next(string& file_path);
+
+private:
+
+    // paths waiting for Next(), the walker pauses when this many are queued
+    static const size_t max_queue_length_ = 4096;
+
+    FileWalkerOptions options_;
+
+    deque<string> deque_paths_;
+
+    bool is_finished_ = false;
+
+    bool is_stopped_ = false;
+
+    mutex mutex_paths_;
+
+    condition_variable cv_pushed_;
+
+    condition_variable cv_popped_;
+
+    thread thread_walker_;
+
+    void WalkHandle(const string& folder_path);
+
+    void WalkFolder(const string& folder_path);
+
+    void ReadManifest(const string& folder_path);
+
+    bool IsMatched(const string& file_name) const;
+
+    bool Push(const string& file_path);
+};
+
+#endif //CLIENT_FILE_WALKER_H
@@ -0,0 +1,395 @@
+#include "image_codec.h"
+#include "logger.h"
+
+#include <cstdio>
+
+#ifdef USE_TURBOJPEG
+atomic<int> ImageCodec::backend_{(int) CodecBackend::TurboJpeg};
+#else
+atomic<int> ImageCodec::backend_{(int) CodecBackend::OpenCV};
+#endif
+
+/*!
+ * @brief choose the backend of jpg, TurboJpeg falls back to OpenCV when not built with USE_TURBOJPEG
+ * @param[in] backend codec backend
+*/
+void ImageCodec::SetBackend(CodecBackend backend) {
+#ifdef USE_TURBOJPEG
+    ImageCodec::backend_ = (int) backend;
+#else
+    (void) backend;
+    ImageCodec::backend_ = (int) CodecBackend::OpenCV;
+#endif
+}
+
+/*!
+ * @brief get the backend of jpg
+ * @return codec backend
+*/
+CodecBackend ImageCodec::GetBackend() {
+    return (CodecBackend) ImageCodec::backend_.load(std::memory_order_relaxed);
+}
+
+/*!
+ * @brief encode image, like cv::imencode
+ * @param[in] mat_image cv::Mat image object
+ * @param[in] format extension, e.g. ".jpg"
+ * @param[in] imencode_params params of cv::imencode, also read by the TurboJPEG path
+ * @param[out] output encoded image, its capacity is reused
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::Encode(const cv::Mat& mat_image, const string& format, const vector<int>& imencode_params,
+                        vector<uchar>& output) {
+#ifdef USE_TURBOJPEG
+    if (ImageCodec::GetBackend() == CodecBackend::TurboJpeg && (format == ".jpg" || format == ".jpeg") &&
+        (mat_image.type() == CV_8UC3 || mat_image.type() == CV_8UC1)) {
+        return ImageCodec::TurboEncode(mat_image, imencode_params, output);
+    }
+#endif
+    return cv::imencode(format, mat_image, output, imencode_params);
+}
+
+/*!
+ * @brief decode image to BGR, like cv::imdecode with IMREAD_COLOR, without copying the input
+ * @param[in] data encoded image
+ * @param[in] length length of data
+ * @param[out] output decoded image, its allocation is reused when the size does not change
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::Decode(const unsigned char* data, long length, cv::Mat& output) {
+    return ImageCodec::DecodeScaled(data, length, 1, output);
+}
+
+/*!
+ * @brief decode image to BGR at a reduced scale and / or cropped to a region
+ * @param[in] data encoded image
+ * @param[in] length length of data
+ * @param[in] options scale and region, a scale only applies to jpg
+ * @param[out] output decoded image, its size is the region divided by the chosen scale
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::Decode(const unsigned char* data, long length, const DecodeOptions& options, cv::Mat& output) {
+    int scale_denom = 1;
+
+    if (ImageCodec::IsJpeg(data, length)) {
+        scale_denom = options.scale_denom;
+
+        int width, height;
+        if (!options.target_size.empty() && ImageCodec::GetJpegSize(data, length, width, height)) {
+            auto source_size = options.roi.empty() ? cv::Size(width, height) : options.roi.size();
+            scale_denom = ImageCodec::GetScaleDenominator(source_size, options.target_size);
+        }
+    }
+
+    if (options.roi.empty()) {
+        return ImageCodec::DecodeScaled(data, length, scale_denom, output);
+    }
+
+    // the whole image is decoded once per thread and only the region is copied out
+    static thread_local cv::Mat mat_scaled;
+    if (!ImageCodec::DecodeScaled(data, length, scale_denom, mat_scaled)) {
+        return false;
+    }
+
+    auto& roi = options.roi;
+    cv::Rect roi_scaled(roi.x / scale_denom, roi.y / scale_denom,
+                        (roi.width + scale_denom - 1) / scale_denom, (roi.height + scale_denom - 1) / scale_denom);
+    roi_scaled = roi_scaled & cv::Rect(0, 0, mat_scaled.cols, mat_scaled.rows);
+
+    if (roi_scaled.empty()) {
+        LOG_WARNING("decode roi is outside of the image");
+        return false;
+    }
+
+    mat_scaled(roi_scaled).copyTo(output);
+    return true;
+}
+
+/*!
+ * @brief load and decode an image file, like cv::imread with DCT scaling and cropping
+ * @param[in] file_path path of image file
+ * @param[in] options scale and region
+ * @param[out] output decoded image
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::Read(const string& file_path, const DecodeOptions& options, cv::Mat& output) {
+    // file contents, its capacity is kept for the next file of this thread
+    static thread_local vector<unsigned char> vector_file;
+
+    if (!ImageCodec::ReadFile(file_path, vector_file)) {
+        return false;
+    }
+
+    return ImageCodec::Decode(vector_file.data(), vector_file.size(), options, output);
+}
+
+/*!
+ * @brief load the bytes of a file
+ * @param[in] file_path path of file
+ * @param[out] output file contents, its capacity is reused
+ * @return true=succeed, false=failed or empty
+*/
+bool ImageCodec::ReadFile(const string& file_path, vector<unsigned char>& output) {
+    FILE* file = fopen(file_path.c_str(), "rb");
+    if (file == nullptr) {
+        LOG_WARNING("can not open " << file_path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    output.resize(length > 0 ? length : 0);
+    bool is_read = length > 0 && (long) fread(output.data(), 1, length, file) == length;
+    fclose(file);
+
+    if (!is_read) {
+        LOG_WARNING("can not read " << file_path);
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * @brief get the size of a jpg from its SOF marker without decoding it
+ * @param[in] data jpg data
+ * @param[in] length length of data
+ * @param[out] width width of image
+ * @param[out] height height of image
+ * @return true=found, false=not a jpg or no SOF marker
+*/
+bool ImageCodec::GetJpegSize(const unsigned char* data, long length, int& width, int& height) {
+    if (!ImageCodec::IsJpeg(data, length)) {
+        return false;
+    }
+
+    long offset = 2;
+    while (offset + 4 <= length) {
+        if (data[offset] != 0xFF) {
+            return false;
+        }
+
+        unsigned char marker = data[offset + 1];
+
+        // fill bytes before a marker
+        if (marker == 0xFF) {
+            offset++;
+            continue;
+        }
+
+        // markers without a segment
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            offset += 2;
+            continue;
+        }
+
+        long segment_length = (data[offset + 2] << 8) | data[offset + 3];
+
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (offset + 9 > length) {
+                return false;
+            }
+            height = (data[offset + 5] << 8) | data[offset + 6];
+            width = (data[offset + 7] << 8) | data[offset + 8];
+            return width > 0 && height > 0;
+        }
+
+        // the entropy coded data starts after SOS, no SOF before it
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;
+        }
+
+        offset += 2 + segment_length;
+    }
+
+    return false;
+}
+
+/*!
+ * @brief get the largest DCT scale which still decodes at least target_size
+ * @param[in] source_size size of image or region
+ * @param[in] target_size size the caller resizes to
+ * @return 1, 2, 4 or 8
+*/
+int ImageCodec::GetScaleDenominator(const cv::Size& source_size, const cv::Size& target_size) {
+    for (int scale_denom = 8; scale_denom > 1; scale_denom /= 2) {
+        if (source_size.width / scale_denom >= target_size.width &&
+            source_size.height / scale_denom >= target_size.height) {
+            return scale_denom;
+        }
+    }
+    return 1;
+}
+
+/*!
+ * @brief check the SOI marker of jpg
+ * @param[in] data encoded image
+ * @param[in] length length of data
+ * @return true=jpg
+*/
+bool ImageCodec::IsJpeg(const unsigned char* data, long length) {
+    return data != nullptr && length > 2 && data[0] == 0xFF && data[1] == 0xD8;
+}
+
+/*!
+ * @brief decode image to BGR at 1 / scale_denom of its size
+ * @param[in] data encoded image
+ * @param[in] length length of data
+ * @param[in] scale_denom 1, 2, 4 or 8, other values decode at full size
+ * @param[out] output decoded image
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::DecodeScaled(const unsigned char* data, long length, int scale_denom, cv::Mat& output) {
+    if (data == nullptr || length <= 0) {
+        return false;
+    }
+
+#ifdef USE_TURBOJPEG
+    if (ImageCodec::GetBackend() == CodecBackend::TurboJpeg && ImageCodec::IsJpeg(data, length)) {
+        return ImageCodec::TurboDecode(data, length, scale_denom, output);
+    }
+#endif
+
+    int flags;
+    switch (scale_denom) {
+        case 2: flags = cv::ImreadModes::IMREAD_REDUCED_COLOR_2; break;
+        case 4: flags = cv::ImreadModes::IMREAD_REDUCED_COLOR_4; break;
+        case 8: flags = cv::ImreadModes::IMREAD_REDUCED_COLOR_8; break;
+        default: flags = cv::ImreadModes::IMREAD_COLOR; break;
+    }
+
+    // header over the input, imdecode reads it in place
+    cv::Mat mat_data(1, (int) length, CV_8UC1, (void *) data);
+    cv::imdecode(mat_data, flags, &output);
+    return !output.empty();
+}
+
+#ifdef USE_TURBOJPEG
+
+/*!
+ * @brief release TurboJPEG handles of an exiting thread
+*/
+ImageCodec::TurboContext::~TurboContext() {
+    if (this->compressor != nullptr) {
+        tjDestroy(this->compressor);
+    }
+    if (this->decompressor != nullptr) {
+        tjDestroy(this->decompressor);
+    }
+}
+
+/*!
+ * @brief get the TurboJPEG context of calling thread, handles are created on first use
+ * @return TurboContext
+*/
+ImageCodec::TurboContext& ImageCodec::GetTurboContext() {
+    static thread_local TurboContext turbo_context;
+
+    if (turbo_context.compressor == nullptr) {
+        turbo_context.compressor = tjInitCompress();
+        turbo_context.decompressor = tjInitDecompress();
+    }
+
+    return turbo_context;
+}
+
+/*!
+ * @brief encode jpg with TurboJPEG straight into output
+ * @param[in] mat_image CV_8UC3 BGR or CV_8UC1 image
+ * @param[in] imencode_params params of cv::imencode, quality, progressive and sampling factor are used
+ * @param[out] output encoded image, a vector kept across frames keeps its capacity
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::TurboEncode(const cv::Mat& mat_image, const vector<int>& imencode_params, vector<uchar>& output) {
+    auto& turbo_context = ImageCodec::GetTurboContext();
+
+    int quality = 95;
+    int subsampling = TJSAMP_420;
+    int flags = TJFLAG_NOREALLOC;
+
+    for (size_t i = 0; i + 1 < imencode_params.size(); i += 2) {
+        int value = imencode_params[i + 1];
+
+        if (imencode_params[i] == cv::IMWRITE_JPEG_QUALITY) {
+            quality = value;
+        } else if (imencode_params[i] == cv::IMWRITE_JPEG_PROGRESSIVE && value != 0) {
+            flags |= TJFLAG_PROGRESSIVE;
+        }
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 6)
+        else if (imencode_params[i] == cv::IMWRITE_JPEG_SAMPLING_FACTOR) {
+            switch (value) {
+                case cv::IMWRITE_JPEG_SAMPLING_FACTOR_444: subsampling = TJSAMP_444; break;
+                case cv::IMWRITE_JPEG_SAMPLING_FACTOR_422: subsampling = TJSAMP_422; break;
+                case cv::IMWRITE_JPEG_SAMPLING_FACTOR_411: subsampling = TJSAMP_411; break;
+                case cv::IMWRITE_JPEG_SAMPLING_FACTOR_440: subsampling = TJSAMP_440; break;
+                default: subsampling = TJSAMP_420; break;
+            }
+        }
+#endif
+    }
+
+    int pixel_format = TJPF_BGR;
+    if (mat_image.type() == CV_8UC1) {
+        pixel_format = TJPF_GRAY;
+        subsampling = TJSAMP_GRAY;
+    }
+
+    // output holds the worst case, so TurboJPEG never reallocates it, a reused vector is not allocated again
+    unsigned long buffer_size = tjBufSize(mat_image.cols, mat_image.rows, subsampling);
+    if (buffer_size == (unsigned long) -1) {
+        LOG_WARNING("tjBufSize: " << tjGetErrorStr2(turbo_context.compressor));
+        return false;
+    }
+    output.resize(buffer_size);
+
+    unsigned char* jpeg_buffer = output.data();
+    unsigned long jpeg_size = buffer_size;
+    if (tjCompress2(turbo_context.compressor, mat_image.data, mat_image.cols, (int) mat_image.step, mat_image.rows,
+                    pixel_format, &jpeg_buffer, &jpeg_size, subsampling, quality, flags) != 0) {
+        LOG_WARNING("tjCompress2: " << tjGetErrorStr2(turbo_context.compressor));
+        output.clear();
+        return false;
+    }
+
+    output.resize(jpeg_size);
+    return true;
+}
+
+/*!
+ * @brief decode jpg with TurboJPEG straight into output, scaled in the DCT domain
+ * @param[in] data jpg data
+ * @param[in] length length of data
+ * @param[in] scale_denom 1, 2, 4 or 8
+ * @param[out] output CV_8UC3 BGR image
+ * @return true=succeed, false=failed
+*/
+bool ImageCodec::TurboDecode(const unsigned char* data, long length, int scale_denom, cv::Mat& output) {
+    auto& turbo_context = ImageCodec::GetTurboContext();
+
+    int width, height, subsampling, colorspace;
+    if (tjDecompressHeader3(turbo_context.decompressor, data, length, &width, &height, &subsampling, &colorspace) != 0) {
+        LOG_WARNING("tjDecompressHeader3: " << tjGetErrorStr2(turbo_context.decompressor));
+        return false;
+    }
+
+    if (scale_denom == 2 || scale_denom == 4 || scale_denom == 8) {
+        tjscalingfactor scaling_factor = {1, scale_denom};
+        width = TJSCALED(width, scaling_factor);
+        height = TJSCALED(height, scaling_factor);
+    }
+
+    // no-op when the previous frame had the same size
+    output.create(height, width, CV_8UC3);
+
+    if (tjDecompress2(turbo_context.decompressor, data, length, output.data, width, (int) output.step, height,
+                      TJPF_BGR, 0) != 0) {
+        LOG_WARNING("tjDecompress2: " << tjGetErrorStr2(turbo_context.decompressor));
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,232 @@
+#include "image_pack.h"
+#include "logger.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const char pack_magic[8] = {'I', 'M', 'G', 'P', 'A', 'C', 'K', '1'};
+
+    const unsigned long pack_version = 1;
+
+    // images start on a cache line, so a pointer into the mapping is as good as a heap buffer
+    const unsigned long pack_alignment = 64;
+}
+
+/*!
+ * @brief close the file, an unfinished pack has no index and is rejected by ImagePack
+*/
+ImagePackWriter::~ImagePackWriter() {
+    if (this->file_ != nullptr) {
+        fclose(this->file_);
+    }
+}
+
+/*!
+ * @brief create the pack file, an existing file is replaced
+ * @param[in] pack_path path of pack file
+ * @return true=succeed, false=failed
+*/
+bool ImagePackWriter::Open(const string& pack_path) {
+    this->file_ = fopen(pack_path.c_str(), "wb");
+    if (this->file_ == nullptr) {
+        perror("Error: fopen");
+        return false;
+    }
+
+    this->offset_ = sizeof(ImagePackHeader);
+    this->vector_entries_.clear();
+    this->names_.clear();
+    return true;
+}
+
+/*!
+ * @brief append an encoded image
+ * @param[in] name file name, relative to the packed folder
+ * @param[in] data encoded image
+ * @param[in] length size of data
+ * @return true=succeed, false=failed
+*/
+bool ImagePackWriter::Add(const string& name, const void* data, long length) {
+    unsigned long offset = (this->offset_ + pack_alignment - 1) / pack_alignment * pack_alignment;
+
+    if (!this->WriteAt(offset, data, length)) {
+        return false;
+    }
+
+    this->vector_entries_.push_back({offset, (unsigned long) length, this->names_.size(), name.size()});
+    this->names_.append(name);
+
+    this->offset_ = offset + length;
+    return true;
+}
+
+/*!
+ * @brief write the index, the name table and the header
+ * @return true=succeed, false=failed
+*/
+bool ImagePackWriter::Finish() {
+    unsigned long index_offset = (this->offset_ + pack_alignment - 1) / pack_alignment * pack_alignment;
+    long index_length = this->vector_entries_.size() * sizeof(ImagePackEntry);
+
+    ImagePackHeader header{};
+    memcpy(header.magic, pack_magic, sizeof(header.magic));
+    header.version = pack_version;
+    header.count = this->vector_entries_.size();
+    header.index_offset = index_offset;
+
+    bool is_written = this->WriteAt(index_offset, this->vector_entries_.data(), index_length) &&
+                      this->WriteAt(index_offset + index_length, this->names_.data(), this->names_.size()) &&
+                      this->WriteAt(0, &header, sizeof(header));
+
+    if (fclose(this->file_) != 0) {
+        is_written = false;
+    }
+    this->file_ = nullptr;
+
+    return is_written;
+}
+
+/*!
+ * @brief write length bytes at offset of the pack file
+ * @param[in] offset offset in the file, the gap from the previous block reads as zeros
+ * @param[in] data input buffer
+ * @param[in] length size of data
+ * @return true=succeed, false=failed
+*/
+bool ImagePackWriter::WriteAt(unsigned long offset, const void* data, long length) {
+    if (fseek(this->file_, offset, SEEK_SET) != 0 ||
+        (length > 0 && fwrite(data, 1, length, this->file_) != (size_t) length)) {
+        perror("Error: fwrite");
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief unmap the pack, pointers from Get() are invalid afterwards
+*/
+ImagePack::~ImagePack() {
+    if (this->mapped_address_ != nullptr) {
+        munmap(this->mapped_address_, this->mapped_length_);
+    }
+}
+
+/*!
+ * @brief map a pack file read-only
+ * @param[in] pack_path path of pack file
+ * @param[in] is_populated true=fault the whole file in now, false=pages are read on first send
+ * @return true=succeed, false=failed
+*/
+bool ImagePack::Open(const string& pack_path, bool is_populated) {
+    int pack_fd = open(pack_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (pack_fd == -1) {
+        perror("Error: open");
+        return false;
+    }
+
+    struct stat pack_stat{};
+    if (fstat(pack_fd, &pack_stat) == -1 || pack_stat.st_size < (long) sizeof(ImagePackHeader)) {
+        LOG_ERROR("pack file " << pack_path << " is too short");
+        close(pack_fd);
+        return false;
+    }
+
+    void* address = mmap(nullptr, pack_stat.st_size, PROT_READ, MAP_PRIVATE | (is_populated ? MAP_POPULATE : 0),
+                         pack_fd, 0);
+    close(pack_fd);
+
+    if (address == MAP_FAILED) {
+        perror("Error: mmap");
+        return false;
+    }
+
+    this->mapped_address_ = address;
+    this->mapped_length_ = pack_stat.st_size;
+
+    // images are sent in index order, let the kernel read ahead
+    madvise(this->mapped_address_, this->mapped_length_, MADV_SEQUENTIAL);
+
+    if (!this->Validate()) {
+        LOG_ERROR("pack file " << pack_path << " is broken");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * @brief get count of images
+ * @return count of images
+*/
+long ImagePack::GetCount() const {
+    return this->count_;
+}
+
+/*!
+ * @brief get an encoded image, the bytes stay in the mapping
+ * @param[in] index index of image
+ * @param[out] data encoded image
+ * @param[out] length size of data
+ * @return true=succeed, false=index out of range
+*/
+bool ImagePack::Get(long index, const unsigned char*& data, long& length) const {
+    if (index < 0 || index >= this->count_) {
+        return false;
+    }
+
+    const auto& entry = this->entries_[index];
+    data = static_cast<const unsigned char*>(this->mapped_address_) + entry.offset;
+    length = entry.length;
+    return true;
+}
+
+/*!
+ * @brief get file name of an image
+ * @param[in] index index of image
+ * @return file name, empty if index is out of range
+*/
+string ImagePack::GetName(long index) const {
+    if (index < 0 || index >= this->count_) {
+        return "";
+    }
+
+    const auto& entry = this->entries_[index];
+    return string(&this->names_[entry.name_offset], entry.name_length);
+}
+
+/*!
+ * @brief check the header and that every entry lies inside the file
+ * @return true=valid
+*/
+bool ImagePack::Validate() {
+    auto base = static_cast<const char*>(this->mapped_address_);
+    auto header = reinterpret_cast<const ImagePackHeader*>(base);
+    unsigned long file_length = this->mapped_length_;
+
+    if (memcmp(header->magic, pack_magic, sizeof(pack_magic)) != 0 || header->version != pack_version ||
+        header->index_offset > file_length ||
+        header->count > (file_length - header->index_offset) / sizeof(ImagePackEntry)) {
+        return false;
+    }
+
+    auto entries = reinterpret_cast<const ImagePackEntry*>(base + header->index_offset);
+    unsigned long names_offset = header->index_offset + header->count * sizeof(ImagePackEntry);
+    unsigned long names_length = file_length - names_offset;
+
+    for (unsigned long i = 0; i < header->count; i++) {
+        const auto& entry = entries[i];
+        if (entry.offset > header->index_offset || entry.length > header->index_offset - entry.offset ||
+            entry.name_offset > names_length || entry.name_length > names_length - entry.name_offset) {
+            return false;
+        }
+    }
+
+    this->entries_ = entries;
+    this->names_ = base + names_offset;
+    this->count_ = header->count;
+    return true;
+}
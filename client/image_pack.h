@@ -0,0 +1,85 @@
+#ifndef CLIENT_IMAGE_PACK_H
+#define CLIENT_IMAGE_PACK_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// layout of a pack file, every number is little-endian uint64:
+//   header: magic "IMGPACK1", version, count of images, offset of the index
+//   encoded images back to back, each aligned to pack_alignment
+//   index: {offset, length, name offset, name length} of each image, names point into the name table
+//   name table: file names relative to the packed folder, not terminated
+struct ImagePackHeader {
+    char magic[8];
+    unsigned long version;
+    unsigned long count;
+    unsigned long index_offset;
+};
+
+struct ImagePackEntry {
+    unsigned long offset;
+    unsigned long length;
+    unsigned long name_offset;
+    unsigned long name_length;
+};
+
+
+// appends already encoded images to a pack file, the index is written by Finish()
+class ImagePackWriter {
+
+public:
+    ~ImagePackWriter();
+
+    bool Open(const string& pack_path);
+
+    bool Add(const string& name, const void* data, long length);
+
+    bool Finish();
+
+private:
+
+    FILE* file_ = nullptr;
+
+    unsigned long offset_ = 0;
+
+    vector<ImagePackEntry> vector_entries_;
+
+    string names_;
+
+    bool WriteAt(unsigned long offset, const void* data, long length);
+};
+
+
+// read-only mapping of a pack file, images are handed out as pointers into the mapping
+class ImagePack {
+
+public:
+    ~ImagePack();
+
+    bool Open(const string& pack_path, bool is_populated = false);
+
+    long GetCount() const;
+
+    bool Get(long index, const unsigned char*& data, long& length) const;
+
+    string GetName(long index) const;
+
+private:
+
+    void* mapped_address_ = nullptr;
+
+    long mapped_length_ = 0;
+
+    const ImagePackEntry* entries_ = nullptr;
+
+    const char* names_ = nullptr;
+
+    long count_ = 0;
+
+    bool Validate();
+};
+
+#endif //CLIENT_IMAGE_PACK_H
@@ -1,4 +1,8 @@
 #include "message.h"
+#include "tls_session.h"
+
+#include <netinet/tcp.h>
+#include <sys/mman.h>
 
 /*!
  * @brief init Message Class
@@ -10,8 +14,17 @@ Message::Message(int socket_fd, const string& client_address) {
     this->socket_fd_ = socket_fd;
     this->client_address_ = client_address;
 
-    this->imencode_params_.push_back(cv::IMWRITE_JPEG_QUALITY);
-    this->imencode_params_.push_back(100);
+    // memfd contents can be passed only over a unix socket
+    struct sockaddr_storage socket_addr{};
+    socklen_t socket_addr_len = sizeof(socket_addr);
+    if (getsockname(socket_fd, (struct sockaddr *)& socket_addr, &socket_addr_len) == 0) {
+        this->is_unix_socket_ = socket_addr.ss_family == AF_UNIX;
+    }
+
+    this->SetEncodeParams(EncodeParams());
+
+    this->recv_buffer_.resize(Message::max_buffer_size_);
+    this->send_buffer_.resize(Message::max_buffer_size_);
 
     this->Clear();
 }
@@ -21,9 +34,131 @@ Message::Message(int socket_fd, const string& client_address) {
  * @param [out] output_content image char[] array for output
  * @param [out] output_length length of char[]
 */
-void Message::GetImageBufferResult(unsigned char *&output_content, long& output_length) {
-    output_content = this->image_buffer_;
+void Message::GetImageBufferResult(unsigned char*& output_content, long& output_length) {
+    output_content = this->content_buffer_;
+    output_length = this->image_buffer_length_;
+}
+
+/*!
+ * @brief get one image of a "binary/image-batch" message, index 0 is the whole content of "binary/image"
+ * @param [in] index index of the image, 0 <= index < GetImageCount()
+ * @param [out] output_content image char[] array for output
+ * @param [out] output_length length of char[], 0 if index is out of range
+*/
+void Message::GetImageBufferResult(int index, unsigned char*& output_content, long& output_length) {
+    if (index < 0 || index >= this->GetImageCount()) {
+        output_content = nullptr;
+        output_length = 0;
+        return;
+    }
+
+    output_content = &this->content_buffer_[this->vector_item_offsets_[index]];
+    output_length = this->vector_item_lengths_[index];
+}
+
+/*!
+ * @brief get the count of images in the loaded message
+ * @return count of images
+*/
+int Message::GetImageCount() const {
+    return (int) this->vector_item_lengths_.size();
+}
+
+/*!
+ * @brief get the content-type of the loaded message
+ * @return content-type, e.g. "binary/image" or "binary/image-batch"
+*/
+const string& Message::GetContentType() const {
+    return this->content_type_;
+}
+
+/*!
+ * @brief get the stream of the loaded message, responses are written to the same stream
+ * @return stream id, 0 for a message without "stream"
+*/
+long Message::GetStreamId() const {
+    return this->stream_id_;
+}
+
+/*!
+ * @brief set the stream of the next written message, many streams share one connection
+ * @param [in] stream_id logical stream, e.g. a camera, 0 leaves "stream" out of the header
+*/
+void Message::SetStreamId(long stream_id) {
+    this->stream_id_ = stream_id;
+}
+
+/*!
+ * @brief get the priority class the peer asked for the stream of the loaded message
+ * @return "critical", "normal", "bulk", or empty
+*/
+const string& Message::GetPriority() const {
+    return this->priority_;
+}
+
+/*!
+ * @brief set the priority of the next written messages, a server scheduling frames serves them by it
+ * @param [in] priority "critical", "normal" or "bulk", empty leaves "priority" out of the header
+*/
+void Message::SetPriority(const string& priority) {
+    this->priority_ = priority;
+}
+
+/*!
+ * @brief get the status of the loaded message
+ * @return "dropped" when the server skipped the frame, empty for a processed frame
+*/
+const string& Message::GetStatus() const {
+    return this->status_;
+}
+
+/*!
+ * @brief get the image of a "binary/mat" message without copying it
+ * @param [out] output_mat header over the received pixels, valid until the next Read()
+ * @return true=got a Mat, false=the loaded message is not "binary/mat"
+*/
+bool Message::GetMatResult(cv::Mat& output_mat) {
+    if (this->content_type_ != "binary/mat") {
+        return false;
+    }
+
+    output_mat = this->mat_received_;
+    return true;
+}
+
+/*!
+ * @brief parse the content of a "text/json" message, e.g. detection results
+ * @param [out] output_json json content
+ * @return true=got json, false=the loaded message is not "text/json" or its content is not json
+*/
+bool Message::GetJsonResult(json& output_json) const {
+    if (this->content_type_ != "text/json") {
+        return false;
+    }
+
+    output_json = json::parse(this->content_buffer_, this->content_buffer_ + this->image_buffer_length_, nullptr, false);
+    return !output_json.is_discarded();
+}
+
+/*!
+ * @brief get the content of a "binary/tensor" message without copying it, e.g. a feature map
+ * @param [out] dtype element type, e.g. "float32"
+ * @param [out] shape size of every dimension, row-major
+ * @param [out] output_content little endian elements, valid until the next Read()
+ * @param [out] output_length length of output_content
+ * @return true=got a tensor, false=the loaded message is not "binary/tensor"
+*/
+bool Message::GetTensorResult(string& dtype, vector<long>& shape, unsigned char*& output_content,
+                              long& output_length) const {
+    if (this->content_type_ != "binary/tensor") {
+        return false;
+    }
+
+    dtype = this->tensor_dtype_;
+    shape = this->vector_tensor_shape_;
+    output_content = this->content_buffer_;
     output_length = this->image_buffer_length_;
+    return true;
 }
 
 /*!
@@ -35,14 +170,25 @@ void Message::Clear() {
     this->is_json_text_loaded_ = false;
     this->is_image_buffer_loaded_ = false;
 
-    this->recv_buffer_length_ = 0;
     this->send_buffer_length_ = 0;
     this->json_text_length_ = 0;
     this->image_buffer_length_ = 0;
 
-    memset(this->recv_buffer_, 0, sizeof(this->recv_buffer_));
-    memset(this->send_buffer_, 0, sizeof(this->send_buffer_));
-    memset(this->image_buffer_, 0, sizeof(this->image_buffer_));
+    // bytes of the next frame which arrived with this one move to the front, buffers keep their size
+    if (this->recv_buffer_offset_ > 0) {
+        memmove(this->recv_buffer_.data(), &this->recv_buffer_[this->recv_buffer_offset_], this->recv_buffer_length_);
+        this->recv_buffer_offset_ = 0;
+    }
+
+    this->ReleaseReceivedContent();
+    this->content_buffer_ = nullptr;
+
+    this->content_type_.clear();
+    this->status_.clear();
+    this->vector_item_offsets_.clear();
+    this->vector_item_lengths_.clear();
+    this->tensor_dtype_.clear();
+    this->vector_tensor_shape_.clear();
 
     this->json_object_.clear();
 
@@ -53,18 +199,51 @@ void Message::Clear() {
 */
 bool Message::Read() {
 
-    while (!this->is_image_buffer_loaded_) {
-
-        // read buffer from socket
-        long recv_length = this->SocketRead();
+    // control messages are answered here, then the next frame is read, maybe from a new transport
+    while (this->ReadFrame()) {
+        if (this->content_type_.compare(0, 8, "control/") != 0) {
+            return true;
+        }
 
-        // -1 means error
-        if (recv_length <= 0)
-        {
-            cout << "socket received length: " << recv_length << ", remote socket closed, BREAK while loop" << endl;
+        if (!this->HandleControl()) {
             return false;
         }
 
+        this->Clear();
+    }
+    return false;
+}
+
+/*!
+ * @brief answer a control message from the peer
+ * @return true=answered, false=socket error
+*/
+bool Message::HandleControl() {
+    if (this->content_type_ == "control/shm-offer") {
+        return this->AcceptShm();
+    }
+
+    if (this->content_type_ == "control/encode") {
+        return this->AcceptEncodeParams();
+    }
+
+    if (this->content_type_ == "control/compress") {
+        return this->AcceptContentEncoding();
+    }
+
+    LOG_WARNING("unsupported control message " << this->content_type_);
+    return true;
+}
+
+/*!
+ * @brief read one message from the transport
+ * @return true=succeed, false=failed
+*/
+bool Message::ReadFrame() {
+
+    // bytes of this frame may have arrived with the previous one, so parse before reading
+    while (true) {
+
         // read protocol header to get json header length
         if (this->json_text_length_ == 0) {
             this->ProcessProtocolHeader();
@@ -80,11 +259,31 @@ bool Message::Read() {
         // if we have read json_header, we process the image_file
         if (this->is_json_text_loaded_) {
             if (!this->is_image_buffer_loaded_) {
-                this->ProcessContent();
+                if (this->json_object_["content-type"] == "binary/mat") {
+                    // raw pixels bypass recv_buffer_
+                    if (!this->ReadMatContent()) {
+                        return false;
+                    }
+                } else {
+                    this->ProcessContent();
+                }
             }
         }
+
+        if (this->is_image_buffer_loaded_) {
+            return true;
+        }
+
+        // read buffer from socket
+        long recv_length = this->SocketRead();
+
+        // -1 means error
+        if (recv_length <= 0)
+        {
+            LOG_WARNING("socket received length: " << recv_length << ", remote socket closed, BREAK while loop");
+            return false;
+        }
     }
-    return true;
 }
 
 /*!
@@ -94,12 +293,15 @@ bool Message::Read() {
 */
 bool Message::WriteImage(const cv::Mat& mat_image) {
     if (!this->is_response_created_) {
-        CreateResponseBuffer(mat_image);
+        auto time_begin = steady_clock::now();
+
+        CreateResponseBuffer(&mat_image, 1, false);
 
         if (this->is_response_created_)
         {
            if(this->SocketWrite())
            {
+               this->UpdateAdaptiveQuality(time_begin);
                return true;
            }
            else
@@ -112,219 +314,1483 @@ bool Message::WriteImage(const cv::Mat& mat_image) {
 }
 
 /*!
- * @brief read data from socket
- * @return recv_length length of the data
+ * @brief write images as one "binary/image-batch" message to socket
+ * @param [in] vector_mat_image cv:Mat image objects
+ * @return true=succeed, false=failed
 */
-long Message::SocketRead() {
-
-    // define a temp buffer
-    char data[Message::max_socket_buffer_size_];
-    memset(data, 0, sizeof(data));
+bool Message::WriteImages(const vector<cv::Mat>& vector_mat_image) {
+    if (!this->is_response_created_) {
+        auto time_begin = steady_clock::now();
 
-    // read socket to temp buffer
-    // -1 means error
-    int recv_length = recv(this->socket_fd_, data, Message::max_socket_buffer_size_, 0);
+        CreateResponseBuffer(vector_mat_image.data(), vector_mat_image.size(), true);
 
-    // check whether recv_length is out of range
-    if (recv_length > 0 && (recv_length + this->recv_buffer_length_) <= max_buffer_size_) {
-        // copy socket message from the temp buffer to recv_buffer_
-        memcpy(&this->recv_buffer_[this->recv_buffer_length_], data, recv_length * sizeof(char));
-        // increase length of recv_buffer_
-        this->recv_buffer_length_ += recv_length;
+        if (this->is_response_created_ && this->SocketWrite()) {
+            this->UpdateAdaptiveQuality(time_begin);
+            return true;
+        }
     }
-
-    return recv_length;
+    return false;
 }
 
 /*!
- * @brief write char[] "send_buffer_" to socket
+ * @brief write raw pixels of cv::Mat as a "binary/mat" message, rows are sent straight from the Mat's buffer
+ * @param [in] mat_image cv:Mat image object
  * @return true=succeed, false=failed
 */
-bool Message::SocketWrite() {
-    long sent = send(this->socket_fd_, this->send_buffer_, this->send_buffer_length_, 0);
-    if (sent > 0) {
-        cout << "# sent " << sent << " bytes to " << this->client_address_ << endl;
-        return true;
-    } else {
+bool Message::WriteMat(const cv::Mat& mat_image) {
+    if (this->is_response_created_ || mat_image.empty()) {
         return false;
     }
-}
 
-/*!
- * @brief create socket response message from cv::Mat object
- * @param [in] mat_image cv::Mat object
- * @return true=succeed, false=failed
-*/
-void Message::CreateResponseBuffer(const cv::Mat& mat_image) {
+    long row_length = mat_image.cols * mat_image.elemSize();
+    long content_length = row_length * mat_image.rows;
 
-    std::vector<uchar> vector_image;
-    auto is_image_file = imencode(".jpg", mat_image, CV_OUT vector_image, this->imencode_params_);
+    bool is_memfd = this->IsMemfdTransfer(content_length);
 
-    if (is_image_file) {
+    auto& json_string = this->json_header_;
+    json_string.assign(R"({"byteorder": "little", "content-type": "binary/mat","content-encoding": "binary", "content-length": )")
+            .append(to_string(content_length)).append(R"(, "rows": )").append(to_string(mat_image.rows))
+            .append(R"(, "cols": )").append(to_string(mat_image.cols)).append(R"(, "type": )").append(to_string(mat_image.type()))
+            .append(R"(, "step": )").append(to_string(row_length)).append(is_memfd ? R"(, "content-transfer": "memfd")" : "");
+    this->AppendStream(json_string);
+    json_string.append("}");
 
-        std::string json_string =
-                R"({"byteorder": "little", "content-type": "binary/image","content-encoding": "binary", "content-length": )" +
-                to_string(vector_image.size()) + "}";
+    unsigned short short_json_length = json_string.size();
 
-        const char *json_chars = json_string.c_str();
-        short short_json_length = json_string.size();
+    Short2Char(this->send_buffer_.data(), short_json_length);
+    this->send_buffer_length_ = Message::protocol_header_length;
 
-        unsigned char header_chars[sizeof(short_json_length)];
-        Short2Char(header_chars, short_json_length);
+    memcpy(&this->send_buffer_[this->send_buffer_length_], json_string.c_str(), short_json_length);
+    this->send_buffer_length_ += short_json_length;
 
-        long header_length = sizeof(header_chars);
+    // pixels go into a memfd which travels with the header
+    if (is_memfd) {
+        auto content = this->CreateContentFd(content_length);
+        if (content == nullptr) {
+            return false;
+        }
 
-        memcpy(&this->send_buffer_[this->send_buffer_length_], header_chars, header_length * sizeof(header_chars[0]));
-        this->send_buffer_length_ += header_length;
+        for (int i = 0; i < mat_image.rows; i++) {
+            memcpy(&content[i * row_length], mat_image.ptr(i), row_length);
+        }
+        munmap(content, content_length);
 
-        memcpy(&this->send_buffer_[this->send_buffer_length_], json_chars, short_json_length * sizeof(json_chars[0]));
-        this->send_buffer_length_ += short_json_length;
+        this->is_response_created_ = true;
+        return this->SocketWrite();
+    }
 
-        memcpy(&this->send_buffer_[this->send_buffer_length_], &vector_image[0],
-               vector_image.size() * sizeof(vector_image[0]));
-        this->send_buffer_length_ += vector_image.size();
+    auto& vector_iov = this->vector_iov_;
+    vector_iov.clear();
+    vector_iov.push_back({this->send_buffer_.data(), (size_t) this->send_buffer_length_});
 
-        this->is_response_created_ = true;
+    // a continuous Mat is one block, otherwise skip the padding at the end of each row
+    if (mat_image.isContinuous()) {
+        vector_iov.push_back({mat_image.data, (size_t) content_length});
+    } else {
+        for (int i = 0; i < mat_image.rows; i++) {
+            vector_iov.push_back({(void *) mat_image.ptr(i), (size_t) row_length});
+        }
     }
 
-    vector_image.clear();
-    vector<uchar>().swap(vector_image);
+    this->is_response_created_ = true;
 
+    return this->SocketWriteVector(vector_iov);
 }
 
 /*!
- * @brief read the length of json text message
+ * @brief answer a frame without images, e.g. "dropped", as an empty "binary/image-batch" with a "status"
+ * @param [in] status status of the frame
+ * @return true=succeed, false=failed
 */
-void Message::ProcessProtocolHeader() {
-    // make sure to load enough data to get protocol_header
-    if(this->recv_buffer_length_ >= Message::protocol_header_length) {
+bool Message::WriteStatus(const string& status) {
+    if (this->is_response_created_) {
+        return false;
+    }
 
-        unsigned char temp_buffer[Message::protocol_header_length];
-        memset(temp_buffer, 0, sizeof(temp_buffer));
-        memcpy(temp_buffer, this->recv_buffer_, Message::protocol_header_length * sizeof(char));
+    auto& json_string = this->json_header_;
+    json_string.assign(R"({"byteorder": "little", "content-type": "binary/image-batch","content-encoding": "binary", "content-length": 0, "status": ")")
+            .append(status).append("\"");
+    this->AppendStream(json_string);
+    json_string.append(R"(, "items": []})");
 
-        // convert char to short, to get json_text_length_
-        this->json_text_length_ = Char2Short(temp_buffer);
+    unsigned short short_json_length = json_string.size();
 
-        // change length of recv_buffer_length_
-        this->recv_buffer_length_ -= Message::protocol_header_length;
+    Short2Char(this->send_buffer_.data(), short_json_length);
+    this->send_buffer_length_ = Message::protocol_header_length;
 
-        // remove protocol_header data from recv_buffer_
-        memcpy(this->recv_buffer_, &this->recv_buffer_[Message::protocol_header_length],
-               this->recv_buffer_length_ * sizeof(char));
-    }
+    memcpy(&this->send_buffer_[this->send_buffer_length_], json_string.c_str(), short_json_length);
+    this->send_buffer_length_ += short_json_length;
+
+    this->is_response_created_ = true;
+    return this->SocketWrite();
 }
 
 /*!
- * @brief read the length of binary image
+ * @brief write json as a "text/json" message, compressed with the encoding agreed for the connection
+ * @param [in] json_content json content, e.g. detection results
+ * @return true=succeed, false=failed
 */
-void Message::ProcessJsonText() {
+bool Message::WriteJson(const json& json_content) {
+    this->json_content_ = json_content.dump();
 
-    if(this->recv_buffer_length_ >= this->json_text_length_) {
+    return this->WritePayload("text/json", "", (const unsigned char *) this->json_content_.data(),
+                              this->json_content_.size());
+}
 
-        char temp_buffer[this->json_text_length_];
-        memset(temp_buffer, 0, sizeof(temp_buffer));
+/*!
+ * @brief write a "binary/tensor" message, compressed with the encoding agreed for the connection
+ * @param [in] data little endian elements, row-major, sent from where they are unless compressed
+ * @param [in] dtype element type, "uint8", "int8", "uint16", "int16", "float16", "int32", "uint32", "float32",
+ *                   "int64", "uint64" or "float64"
+ * @param [in] shape size of every dimension
+ * @return true=succeed, false=failed or unknown dtype
+*/
+bool Message::WriteTensor(const void* data, const string& dtype, const vector<long>& shape) {
+    long element_size = Message::GetDtypeSize(dtype);
+    if (element_size == 0) {
+        LOG_WARNING("unsupported tensor dtype " << dtype);
+        return false;
+    }
 
-        memcpy(temp_buffer, this->recv_buffer_, this->json_text_length_ * sizeof(char));
-        memset(&temp_buffer[this->json_text_length_], '\0', 1);
+    long content_length = element_size;
+    string json_shape;
+    for (auto size : shape) {
+        if (size < 0 || (size > 0 && content_length > Message::max_frame_size_ / size)) {
+            LOG_WARNING("tensor of dtype " << dtype << " is too large to send");
+            return false;
+        }
+        content_length *= size;
 
-        string str_json(temp_buffer);
+        json_shape.append(json_shape.empty() ? "" : ", ").append(to_string(size));
+    }
 
-        // get json object from json string
-        this->json_object_ = json::parse(str_json);
+    string json_fields;
+    json_fields.append(R"(, "dtype": ")").append(dtype).append(R"(", "shape": [)").append(json_shape).append("]");
 
-        // record the content length of image file
-        this->image_buffer_length_ = (long)this->json_object_["content-length"];
+    return this->WritePayload("binary/tensor", json_fields, (const unsigned char *) data, content_length);
+}
 
-        // change length of recv_buffer_length_
-        this->recv_buffer_length_ -= this->json_text_length_;
+/*!
+ * @brief write the elements of a cv::Mat as a "binary/tensor" message, its channels are the last dimension
+ * @param [in] mat_tensor cv::Mat of any dims, e.g. a blob of cv::dnn
+ * @return true=succeed, false=failed
+*/
+bool Message::WriteTensor(const cv::Mat& mat_tensor) {
+    static const char* array_dtypes[] = {"uint8", "int8", "uint16", "int16", "int32", "float32", "float64", "float16"};
 
-        // remove json_text data from recv_buffer_
-        memcpy(this->recv_buffer_, &this->recv_buffer_[this->json_text_length_],
-               this->recv_buffer_length_ * sizeof(char));
+    if (mat_tensor.empty()) {
+        return false;
+    }
 
-        this->is_json_text_loaded_ = true;
+    vector<long> shape;
+    for (int i = 0; i < mat_tensor.dims; i++) {
+        shape.push_back(mat_tensor.size[i]);
     }
+    if (mat_tensor.channels() > 1) {
+        shape.push_back(mat_tensor.channels());
+    }
+
+    // the rows of a roi are not contiguous
+    cv::Mat mat_continuous = mat_tensor.isContinuous() ? mat_tensor : mat_tensor.clone();
+
+    return this->WriteTensor(mat_continuous.data, array_dtypes[mat_tensor.depth()], shape);
 }
 
 /*!
- * @brief load binary image data into char[] "recv_buffer_", and set the length value to "image_buffer_length_"
+ * @brief write a "text/json" or "binary/tensor" message, its content compressed when it shrinks, sent from
+ *        where it is otherwise
+ * @param [in] content_type "text/json" or "binary/tensor"
+ * @param [in] json_fields fields of the json header after "content-length", each starting with ", "
+ * @param [in] content content
+ * @param [in] content_length length of content
+ * @return true=succeed, false=failed
 */
-void Message::ProcessContent() {
+bool Message::WritePayload(const string& content_type, const string& json_fields, const unsigned char* content,
+                           long content_length) {
+    if (this->is_response_created_) {
+        return false;
+    }
 
-    if (this->image_buffer_length_ == 0) {
-        this->image_buffer_length_ = (long) this->json_object_["content-length"];
+    const auto& encoding = this->content_encoding_;
+    long original_length = content_length;
+    bool is_compressed = false;
+
+    if (encoding != "binary" && content_length >= Message::compression_threshold_ &&
+        ReserveBuffer(this->compressed_content_, PayloadCodec::GetCompressBound(encoding, content_length))) {
+        long compressed_length = PayloadCodec::Compress(encoding, this->compression_level_, content, content_length,
+                                                        this->compressed_content_.data(),
+                                                        this->compressed_content_.size());
+
+        // content which does not shrink, e.g. noise, goes as it is
+        if (compressed_length > 0 && compressed_length < content_length) {
+            content = this->compressed_content_.data();
+            content_length = compressed_length;
+            is_compressed = true;
+        }
     }
 
-    // check data length
-    if (this->image_buffer_length_ > this->recv_buffer_length_) {
-        return;
-    } else {
-        string byteorder(this->json_object_["byteorder"]);
-        string content_type(this->json_object_["content-type"]);
+    bool is_memfd = this->IsMemfdTransfer(content_length);
+
+    auto& json_string = this->json_header_;
+    json_string.assign(R"({"byteorder": "little", "content-type": ")").append(content_type)
+            .append(R"(","content-encoding": ")").append(is_compressed ? encoding : "binary")
+            .append(R"(", "content-length": )").append(to_string(content_length));
+    if (is_compressed) {
+        json_string.append(R"(, "original-length": )").append(to_string(original_length));
+    }
+    json_string.append(json_fields).append(is_memfd ? R"(, "content-transfer": "memfd")" : "");
+    this->AppendStream(json_string);
+    json_string.append("}");
 
-        if (content_type == "binary/image") {
-            memset(this->image_buffer_, 0, sizeof(this->image_buffer_length_));
-            memcpy(this->image_buffer_, this->recv_buffer_, this->image_buffer_length_ * sizeof(char));
+    if (json_string.size() > USHRT_MAX || content_length > Message::max_frame_size_) {
+        LOG_WARNING(content_type << " message of " << content_length << " bytes is too large to send");
+        return false;
+    }
 
-            // change length of recv_buffer_length_
-            this->recv_buffer_length_ -= this->image_buffer_length_;
+    unsigned short short_json_length = json_string.size();
 
-            if(this->recv_buffer_length_ > 0)
-            {
-                // remove content data from recv_buffer_
-                memcpy(this->recv_buffer_, &this->recv_buffer_[this->image_buffer_length_],
-                       this->recv_buffer_length_ * sizeof(char));
-            }
+    Short2Char(this->send_buffer_.data(), short_json_length);
+    this->send_buffer_length_ = Message::protocol_header_length;
 
-        } else {
-            // else if(content_type == "text/json")
-            // string content_encoding(this->json_object_["content-encoding"]);
-            // char temp_buffer[this->image_buffer_length_];
-            // memset(temp_buffer, 0, sizeof(temp_buffer));
-            // memcpy(temp_buffer, this->recv_buffer_, this->image_buffer_length_ * sizeof(char));
-            // string str_content(temp_buffer);
-            // get another json object from json text
-            // auto data = json::parse(str_json);
-            cout << "unsupported content_type!" << endl;
+    memcpy(&this->send_buffer_[this->send_buffer_length_], json_string.c_str(), short_json_length);
+    this->send_buffer_length_ += short_json_length;
+
+    this->is_response_created_ = true;
+
+    // content goes into a memfd which travels with the header
+    if (is_memfd) {
+        auto content_fd = this->CreateContentFd(content_length);
+        if (content_fd == nullptr) {
+            return false;
         }
 
-        this->json_object_.clear();
-        this->is_image_buffer_loaded_ = true;
+        memcpy(content_fd, content, content_length);
+        munmap(content_fd, content_length);
+
+        return this->SocketWrite();
     }
 
+    auto& vector_iov = this->vector_iov_;
+    vector_iov.clear();
+    vector_iov.push_back({this->send_buffer_.data(), (size_t) this->send_buffer_length_});
+    vector_iov.push_back({(void *) content, (size_t) content_length});
+
+    return this->SocketWriteVector(vector_iov);
 }
 
 /*!
- * @brief convert short to char*
- * @param[out] char_str output char* variable
- * @param[in] short_str input short variable
+ * @brief check for received bytes not parsed yet, a reader polling the socket must not wait while they are there
+ * @return true=bytes of the next frame are buffered, by this Message or decrypted by OpenSSL
 */
-void Message::Short2Char(unsigned char *char_str, unsigned char short_str) {
-    unsigned short s = short_str;
-    for (int x = 0; x < 2; x++) {
-        char_str[x] = s & 0xffu;
-        s = s >> 8u;
+bool Message::IsReadBuffered() const {
+    return this->recv_buffer_length_ > 0 || (this->tls_session_ && this->tls_session_->HasPending());
+}
+
+/*!
+ * @brief check whether frames go through shared memory, which can not be polled like the socket
+ * @return true=shared memory transport
+*/
+bool Message::IsShmTransport() const {
+    return this->shm_channel_ != nullptr;
+}
+
+/*!
+ * @brief ack every read of a tcp socket at once, the header of the next frame is not held back by a delayed ack
+ * @param [in] is_quick_ack true=set TCP_QUICKACK after every read
+*/
+void Message::SetQuickAck(bool is_quick_ack) {
+    this->is_quick_ack_ = is_quick_ack && !this->is_unix_socket_;
+}
+
+/*!
+ * @brief send large frames of a tcp socket with MSG_ZEROCOPY, the kernel reads them in place instead of copying
+ * @param [in] is_zero_copy true=zero copy from now on, false=copy again
+ * @return true=succeed, false=not a tcp socket or the kernel does not support it
+*/
+bool Message::SetZeroCopy(bool is_zero_copy) {
+    if (!is_zero_copy) {
+        this->zero_copy_sender_.reset();
+        return true;
+    }
+
+    // kTLS encrypts into pages of its own and refuses MSG_ZEROCOPY, frames still leave from where they are
+    if (this->tls_session_) {
+        LOG_INFO("zero copy is not used over TLS");
+        return false;
+    }
+
+    if (this->is_unix_socket_ || !ZeroCopySender::Enable(this->socket_fd_)) {
+        return false;
     }
+
+    this->zero_copy_sender_.reset(new ZeroCopySender(this->socket_fd_, Message::zero_copy_buffer_count_));
+    return true;
 }
 
 /*!
- * @brief convert char* to short
- * @param[in] char_str input char* variable
- * @return short value
+ * @brief run the TLS handshake on the socket, every byte after it is encrypted, call before anything else is sent
+ * @param [in] tls_context context of the Server or the Client
+ * @return true=succeed, false=handshake failed, the connection can not be used
 */
-unsigned short Message::Char2Short(const unsigned char *char_str) {
-    unsigned short s0 = char_str[0];
-    unsigned short s1 = char_str[1];
-//    unsigned short s0 = char_str[0] | 0xffu;
-//    unsigned short s1 = char_str[1] | 0xffu;
+bool Message::StartTls(const shared_ptr<TlsContext>& tls_context) {
+    unique_ptr<TlsSession> tls_session(new TlsSession(tls_context, this->socket_fd_));
+    if (!tls_session->Handshake()) {
+        return false;
+    }
 
-    s1 = s1 << 8u;
-    unsigned short s = (short) (s0 | s1);
-    return s;
+    if (!tls_session->IsKernelSend() || !tls_session->IsKernelRecv()) {
+        LOG_WARNING("kTLS is not available for " << this->client_address_ << ", records are encrypted in user space, "
+                    "check that the tls kernel module is loaded");
+    }
+
+    this->zero_copy_sender_.reset();
+    this->tls_session_ = std::move(tls_session);
+    return true;
 }
 
-Message::~Message() {
+/*!
+ * @brief offer a shared memory channel to the server, frames go through it once the server accepts
+ * @param [in] capacity bytes of each direction's ring
+ * @return true=shared memory is used from now on, false=keep using the socket
+*/
+bool Message::RequestShm(long capacity) {
+    static atomic<int> shm_count{0};
+
+    string shm_name = "/cpp_socket_demo_" + to_string(getpid()) + "_" + to_string(shm_count++);
+
+    unique_ptr<ShmChannel> shm_channel(new ShmChannel(this->socket_fd_));
+    if (!shm_channel->Create(shm_name, capacity)) {
+        return false;
+    }
+
+    this->Clear();
+
+    if (!this->WriteControl(R"({"byteorder": "little", "content-type": "control/shm-offer", "content-length": 0, "shm-name": ")" +
+                            shm_name + R"("})") || !this->ReadFrame()) {
+        return false;
+    }
+
+    bool is_accepted = this->content_type_ == "control/shm-answer" && this->control_json_["status"] == "ok";
+    this->Clear();
+
+    if (!is_accepted) {
+        LOG_WARNING("server refused shared memory, keep using socket");
+        return false;
+    }
+
+    // both sides have mapped it, the name is not needed any more
+    shm_channel->Unlink();
+    this->shm_channel_ = std::move(shm_channel);
+
+    LOG_INFO("frames go through shared memory " << shm_name);
+    return true;
+}
+
+/*!
+ * @brief answer a "control/shm-offer" message and switch to shared memory on success
+ * @return true=answered, false=socket error
+*/
+bool Message::AcceptShm() {
+    string shm_name = this->control_json_.value("shm-name", "");
+
+    unique_ptr<ShmChannel> shm_channel(new ShmChannel(this->socket_fd_));
+    bool is_opened = !shm_name.empty() && shm_channel->Open(shm_name);
+
+    if (!this->WriteControl(string(R"({"byteorder": "little", "content-type": "control/shm-answer", "content-length": 0, "status": ")") +
+                            (is_opened ? "ok" : "error") + R"("})")) {
+        return false;
+    }
+
+    if (is_opened) {
+        this->shm_channel_ = std::move(shm_channel);
+        LOG_INFO("client " << this->client_address_ << " switched to shared memory " << shm_name);
+    }
+    return true;
+}
+
+/*!
+ * @brief set how images are encoded by WriteImage() and WriteImages() of this side
+ * @param [in] params encode params
+*/
+void Message::SetEncodeParams(const EncodeParams& params) {
+    this->encode_params_ = params;
+    this->adaptive_quality_.Reset(params);
+    this->imencode_params_ = params.ToImencodeParams(this->adaptive_quality_.GetQuality());
+}
+
+/*!
+ * @brief get how WriteImage() and WriteImages() encode right now, for images encoded outside this Message
+ * @param [out] format extension passed to cv::imencode
+ * @param [out] imencode_params params passed to cv::imencode, at the current adaptive quality
+*/
+void Message::GetImencodeParams(string& format, vector<int>& imencode_params) const {
+    format = this->encode_params_.format;
+    imencode_params = this->imencode_params_;
+}
+
+/*!
+ * @brief ask the peer to encode its images with params, and use them on this side too
+ * @param [in] params encode params
+ * @return true=the peer accepted, false=socket error or refused
+*/
+bool Message::RequestEncodeParams(const EncodeParams& params) {
+    this->SetEncodeParams(params);
+
+    auto json_object = params.ToJson();
+    json_object["byteorder"] = "little";
+    json_object["content-type"] = "control/encode";
+    json_object["content-length"] = 0;
+
+    this->Clear();
+
+    if (!this->WriteControl(json_object.dump()) || !this->ReadFrame()) {
+        return false;
+    }
+
+    bool is_accepted = this->content_type_ == "control/encode-answer" && this->control_json_["status"] == "ok";
+    if (is_accepted) {
+        LOG_INFO("server encodes " << this->control_json_.value("format", "") << " at quality "
+                 << this->control_json_.value("quality", 0));
+    }
+
+    this->Clear();
+    return is_accepted;
+}
+
+/*!
+ * @brief apply the params of a "control/encode" message to the responses and answer with the effective params
+ * @return true=answered, false=socket error
+*/
+bool Message::AcceptEncodeParams() {
+    this->SetEncodeParams(EncodeParams::FromJson(this->control_json_));
+
+    auto json_object = this->encode_params_.ToJson();
+    json_object["byteorder"] = "little";
+    json_object["content-type"] = "control/encode-answer";
+    json_object["content-length"] = 0;
+    json_object["status"] = "ok";
+
+    LOG_INFO("client " << this->client_address_ << " asks for " << this->encode_params_.format << " at quality "
+             << this->encode_params_.quality << (this->encode_params_.is_adaptive ? ", adaptive" : ""));
+
+    return this->WriteControl(json_object.dump());
+}
+
+/*!
+ * @brief ask the peer to compress its "text/json" and "binary/tensor" contents, and compress ours the same way
+ * @param [in] vector_encodings encodings in order of preference, e.g. {"zstd", "lz4"}
+ * @param [in] level compression level, 0 = the library default
+ * @return true=the peer answered, false=socket error, refused or none of the encodings is built
+*/
+bool Message::RequestContentEncoding(const vector<string>& vector_encodings, int level) {
+    // only offer what this side can decompress
+    json json_encodings = json::array();
+    for (const auto& encoding : vector_encodings) {
+        if (PayloadCodec::IsSupported(encoding)) {
+            json_encodings.push_back(encoding);
+        }
+    }
+
+    if (json_encodings.empty()) {
+        LOG_WARNING("none of the content encodings is built, configure with -DUSE_LZ4=ON or -DUSE_ZSTD=ON");
+        return false;
+    }
+
+    json json_object;
+    json_object["byteorder"] = "little";
+    json_object["content-type"] = "control/compress";
+    json_object["content-length"] = 0;
+    json_object["accept-encoding"] = json_encodings;
+    json_object["level"] = level;
+
+    this->Clear();
+
+    if (!this->WriteControl(json_object.dump()) || !this->ReadFrame()) {
+        return false;
+    }
+
+    bool is_accepted = this->content_type_ == "control/compress-answer" && this->control_json_["status"] == "ok";
+    if (is_accepted) {
+        string encoding = this->control_json_.value("content-encoding", "binary");
+
+        this->content_encoding_ = PayloadCodec::IsSupported(encoding) ? encoding : "binary";
+        this->compression_level_ = level;
+        LOG_INFO("contents are compressed with " << this->content_encoding_);
+    }
+
+    this->Clear();
+    return is_accepted;
+}
+
+/*!
+ * @brief choose the first encoding of a "control/compress" message this side supports and answer with it,
+ *        "binary" when there is none
+ * @return true=answered, false=socket error
+*/
+bool Message::AcceptContentEncoding() {
+    this->content_encoding_ = "binary";
+    this->compression_level_ = this->control_json_.value("level", 0);
+
+    auto iter = this->control_json_.find("accept-encoding");
+    if (iter != this->control_json_.end() && iter->is_array()) {
+        for (const auto& encoding : *iter) {
+            if (encoding.is_string() && PayloadCodec::IsSupported(encoding.get<string>())) {
+                this->content_encoding_ = encoding.get<string>();
+                break;
+            }
+        }
+    }
+
+    json json_object;
+    json_object["byteorder"] = "little";
+    json_object["content-type"] = "control/compress-answer";
+    json_object["content-length"] = 0;
+    json_object["content-encoding"] = this->content_encoding_;
+    json_object["status"] = "ok";
+
+    LOG_INFO("client " << this->client_address_ << " gets contents compressed with " << this->content_encoding_);
+
+    return this->WriteControl(json_object.dump());
+}
+
+/*!
+ * @brief feed the time of one frame to the adaptive quality and rebuild the imencode params when it changes
+ * @param [in] time_begin time before encoding the frame
+*/
+void Message::UpdateAdaptiveQuality(const steady_clock::time_point& time_begin) {
+    double frame_ms = duration_cast<microseconds>(steady_clock::now() - time_begin).count() / 1000.0;
+
+    if (this->adaptive_quality_.Update(frame_ms)) {
+        this->imencode_params_ = this->encode_params_.ToImencodeParams(this->adaptive_quality_.GetQuality());
+        LOG_DEBUG("encode quality changed to " << this->adaptive_quality_.GetQuality() << " for "
+                  << this->client_address_ << ", frame took " << frame_ms << " ms");
+    }
+}
+
+/*!
+ * @brief write a json header without content
+ * @param [in] json_string json header, must contain "content-length": 0
+ * @return true=succeed, false=failed
+*/
+bool Message::WriteControl(const string& json_string) {
+    unsigned short short_json_length = json_string.size();
+
+    Short2Char(this->send_buffer_.data(), short_json_length);
+    memcpy(&this->send_buffer_[Message::protocol_header_length], json_string.c_str(), short_json_length);
+    this->send_buffer_length_ = Message::protocol_header_length + short_json_length;
+
+    bool is_written = this->SocketWrite();
+    this->send_buffer_length_ = 0;
+    return is_written;
+}
+
+/*!
+ * @brief receive from shared memory if negotiated, otherwise from socket
+ * @param [out] buffer output buffer
+ * @param [in] length size of buffer
+ * @return count of bytes, <= 0 means error or closed
+*/
+long Message::TransportRecv(void* buffer, long length) {
+    if (this->shm_channel_) {
+        return this->shm_channel_->Read(buffer, length);
+    }
+
+    if (this->tls_session_ && !this->tls_session_->IsKernelRecv()) {
+        return this->tls_session_->Read(buffer, length);
+    }
+
+    if (!this->is_unix_socket_) {
+        long recv_length = recv(this->socket_fd_, buffer, length, 0);
+
+        // the kernel falls back to delayed acks on its own
+        if (this->is_quick_ack_ && recv_length > 0) {
+            int value = 1;
+            setsockopt(this->socket_fd_, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+        }
+        return recv_length;
+    }
+
+    // a unix socket may carry memfd contents as SCM_RIGHTS
+    struct iovec iov{buffer, (size_t) length};
+    char control[CMSG_SPACE(sizeof(int) * Message::max_received_fds_)];
+
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    long recv_length = recvmsg(this->socket_fd_, &msg, MSG_CMSG_CLOEXEC);
+
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            auto fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < fd_count; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                this->deque_received_fds_.push_back(fd);
+            }
+        }
+    }
+
+    return recv_length;
+}
+
+/*!
+ * @brief send to shared memory if negotiated, otherwise to socket
+ * @param [in] buffer input buffer
+ * @param [in] length size of buffer
+ * @return count of bytes, <= 0 means error
+*/
+long Message::TransportSend(const void* buffer, long length) {
+    if (this->shm_channel_) {
+        return this->shm_channel_->Write(buffer, length);
+    }
+    if (this->tls_session_ && !this->tls_session_->IsKernelSend()) {
+        return this->tls_session_->Write(buffer, length);
+    }
+    return send(this->socket_fd_, buffer, length, 0);
+}
+
+/*!
+ * @brief send the first bytes of a frame together with send_fd_, then close send_fd_
+ * @param [in] buffer input buffer
+ * @param [in] length size of buffer
+ * @return count of bytes, <= 0 means error
+*/
+long Message::SendWithFd(const void* buffer, long length) {
+    struct iovec iov{(void *) buffer, (size_t) length};
+    char control[CMSG_SPACE(sizeof(int))]{};
+
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &this->send_fd_, sizeof(int));
+
+    long sent = sendmsg(this->socket_fd_, &msg, 0);
+
+    // the receiver holds its own reference once sendmsg() returns
+    close(this->send_fd_);
+    this->send_fd_ = -1;
+
+    return sent;
+}
+
+/*!
+ * @brief check whether a content should be passed as a memfd
+ * @param [in] content_length length of content
+ * @return true=use a memfd
+*/
+bool Message::IsMemfdTransfer(long content_length) const {
+    return this->is_unix_socket_ && !this->shm_channel_ && content_length >= Message::memfd_threshold_;
+}
+
+/*!
+ * @brief create a memfd for the content of the next frame, it is sent by SocketWrite()
+ * @param [in] length length of content
+ * @return writable mapping of the memfd, the caller unmaps it, nullptr if failed
+*/
+unsigned char* Message::CreateContentFd(long length) {
+    int fd = memfd_create("cpp_socket_demo", MFD_CLOEXEC);
+    if (fd == -1) {
+        perror("Error: memfd_create");
+        return nullptr;
+    }
+
+    void* address = MAP_FAILED;
+    if (ftruncate(fd, length) == 0) {
+        address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (address == MAP_FAILED) {
+        perror("Error: memfd mmap");
+        close(fd);
+        return nullptr;
+    }
+
+    this->send_fd_ = fd;
+    return static_cast<unsigned char*>(address);
+}
+
+/*!
+ * @brief map the memfd of a message with "content-transfer": "memfd"
+ * @return true=succeed, false=no fd arrived or mmap failed
+*/
+bool Message::MapReceivedContent() {
+    if (this->deque_received_fds_.empty() || this->image_buffer_length_ <= 0 ||
+        this->image_buffer_length_ > Message::max_frame_size_) {
+        return false;
+    }
+
+    int fd = this->deque_received_fds_.front();
+    this->deque_received_fds_.pop_front();
+
+    // private mapping, so the content can be processed in place without touching the sender's pages
+    void* address = mmap(nullptr, this->image_buffer_length_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (address == MAP_FAILED) {
+        perror("Error: memfd mmap");
+        return false;
+    }
+
+    this->mapped_content_ = address;
+    this->mapped_content_length_ = this->image_buffer_length_;
+    return true;
+}
+
+/*!
+ * @brief unmap the memfd content of the previous message, or release its slot of the shm ring
+*/
+void Message::ReleaseReceivedContent() {
+    if (this->shm_content_ != nullptr) {
+        if (this->mat_received_.data == this->shm_content_) {
+            this->mat_received_.release();
+        }
+
+        this->shm_channel_->Consume(this->shm_content_length_);
+        this->shm_content_ = nullptr;
+        this->shm_content_length_ = 0;
+    }
+
+    if (this->mapped_content_ == nullptr) {
+        return;
+    }
+
+    if (this->mat_received_.data == this->mapped_content_) {
+        this->mat_received_.release();
+    }
+
+    munmap(this->mapped_content_, this->mapped_content_length_);
+    this->mapped_content_ = nullptr;
+    this->mapped_content_length_ = 0;
+}
+
+/*!
+ * @brief find the content of the loaded json header in the shm ring, it stays there until Clear()
+ * @return content, nullptr if the transport is not shm or the content does not lie in one piece in the ring
+*/
+unsigned char* Message::PeekShmContent() {
+    if (!this->shm_channel_ || this->recv_buffer_length_ > 0) {
+        return nullptr;
+    }
+
+    this->shm_content_ = this->shm_channel_->Peek(this->image_buffer_length_);
+    this->shm_content_length_ = this->shm_content_ != nullptr ? this->image_buffer_length_ : 0;
+    return this->shm_content_;
+}
+
+/*!
+ * @brief read data from socket
+ * @return recv_length length of the data
+*/
+long Message::SocketRead() {
+
+    long used_length = this->recv_buffer_offset_ + this->recv_buffer_length_;
+
+    long max_socket_buffer_size = Message::max_socket_buffer_size_;
+    long max_frame_size = Message::max_frame_size_;
+
+    // grow recv_buffer_ for large frames, up to max_frame_size_
+    ReserveBuffer(this->recv_buffer_, std::min(used_length + max_socket_buffer_size, max_frame_size));
+
+    long free_length = std::min<long>(this->recv_buffer_.size() - used_length, max_socket_buffer_size);
+    if (free_length <= 0) {
+        LOG_WARNING("frame is larger than " << Message::max_frame_size_ << " bytes");
+        return -1;
+    }
+
+    // shared memory is read up to the end of the current part only, so a content can stay in the ring
+    if (this->shm_channel_) {
+        long part_length = this->json_text_length_ == 0 ? Message::protocol_header_length :
+                           !this->is_json_text_loaded_ ? this->json_text_length_ : this->image_buffer_length_;
+        if (part_length > this->recv_buffer_length_) {
+            free_length = std::min(free_length, part_length - this->recv_buffer_length_);
+        }
+    }
+
+    // read socket straight into recv_buffer_
+    // -1 means error
+    long recv_length = this->TransportRecv(&this->recv_buffer_[used_length], free_length);
+
+    if (recv_length > 0) {
+        // increase length of recv_buffer_
+        this->recv_buffer_length_ += recv_length;
+    }
+
+    return recv_length;
+}
+
+/*!
+ * @brief write char[] "send_buffer_" to socket
+ * @return true=succeed, false=failed
+*/
+bool Message::SocketWrite() {
+    long sent = 0;
+
+    // send_buffer_ goes to the kernel as it is, a buffer the kernel is done with takes its place
+    if (this->zero_copy_sender_ && !this->shm_channel_ && this->send_fd_ < 0 &&
+        this->send_buffer_length_ >= Message::zero_copy_threshold_) {
+        bool is_sent = this->zero_copy_sender_->SendBuffer(this->send_buffer_, this->send_buffer_length_);
+        ReserveBuffer(this->send_buffer_, Message::max_buffer_size_);
+
+        LOG_FRAME("# sent " << this->send_buffer_length_ << " bytes to " << this->client_address_ << " with zero copy");
+        return is_sent;
+    }
+
+    // a large frame may need more than one send()
+    while (sent < this->send_buffer_length_) {
+        long length = this->send_fd_ >= 0 ?
+                      this->SendWithFd(&this->send_buffer_[sent], this->send_buffer_length_ - sent) :
+                      this->TransportSend(&this->send_buffer_[sent], this->send_buffer_length_ - sent);
+        if (length <= 0) {
+            return false;
+        }
+        sent += length;
+    }
+
+    LOG_FRAME("# sent " << sent << " bytes to " << this->client_address_);
+    return true;
+}
+
+/*!
+ * @brief write blocks to socket with sendmsg, without gathering them into send_buffer_
+ * @param [in,out] vector_iov blocks to send, consumed while sending
+ * @return true=succeed, false=failed
+*/
+bool Message::SocketWriteVector(vector<iovec>& vector_iov) {
+    size_t iov_index = 0;
+    long sent = 0;
+
+    // shared memory takes the blocks one by one
+    if (this->shm_channel_) {
+        for (const auto& iov : vector_iov) {
+            if (this->shm_channel_->Write(iov.iov_base, iov.iov_len) < 0) {
+                return false;
+            }
+            sent += iov.iov_len;
+        }
+
+        LOG_FRAME("# sent " << sent << " bytes to " << this->client_address_ << " through shared memory");
+        return true;
+    }
+
+    // OpenSSL encrypts the blocks one by one when the kernel does not
+    if (this->tls_session_ && !this->tls_session_->IsKernelSend()) {
+        for (const auto& iov : vector_iov) {
+            if (iov.iov_len > 0 && this->tls_session_->Write(iov.iov_base, iov.iov_len) <= 0) {
+                return false;
+            }
+            sent += iov.iov_len;
+        }
+
+        LOG_FRAME("# sent " << sent << " bytes to " << this->client_address_);
+        return true;
+    }
+
+    // the blocks belong to the caller, sending waits until the kernel is done with them
+    if (this->zero_copy_sender_) {
+        for (const auto& iov : vector_iov) {
+            sent += iov.iov_len;
+        }
+
+        if (sent >= Message::zero_copy_threshold_) {
+            bool is_sent = this->zero_copy_sender_->SendVector(vector_iov);
+
+            LOG_FRAME("# sent " << sent << " bytes to " << this->client_address_ << " with zero copy");
+            return is_sent;
+        }
+        sent = 0;
+    }
+
+    while (iov_index < vector_iov.size()) {
+        struct msghdr msg{};
+        msg.msg_iov = &vector_iov[iov_index];
+        msg.msg_iovlen = std::min<size_t>(vector_iov.size() - iov_index, IOV_MAX);
+
+        long length = sendmsg(this->socket_fd_, &msg, 0);
+        if (length <= 0) {
+            return false;
+        }
+        sent += length;
+
+        // skip the blocks already sent, and move into a partly sent block
+        while (length > 0 && iov_index < vector_iov.size()) {
+            auto& iov = vector_iov[iov_index];
+            if ((size_t) length >= iov.iov_len) {
+                length -= iov.iov_len;
+                iov_index++;
+            } else {
+                iov.iov_base = (char *) iov.iov_base + length;
+                iov.iov_len -= length;
+                length = 0;
+            }
+        }
+    }
+
+    LOG_FRAME("# sent " << sent << " bytes to " << this->client_address_);
+    return true;
+}
+
+/*!
+ * @brief receive the pixels of a "binary/mat" message straight into mat_received_
+ * @return true=succeed, false=socket error or bad header
+*/
+bool Message::ReadMatContent() {
+    // the header comes from the peer, nothing is allocated before it is checked
+    for (const char* key : {"rows", "cols", "type", "step"}) {
+        auto iter = this->json_object_.find(key);
+        if (iter == this->json_object_.end() || !iter->is_number_integer()) {
+            LOG_WARNING("bad binary/mat header, " << key << " is missing or not an integer");
+            return false;
+        }
+    }
+
+    long rows = this->json_object_.value("rows", 0L);
+    long cols = this->json_object_.value("cols", 0L);
+    long type = this->json_object_.value("type", -1L);
+    long step = this->json_object_.value("step", 0L);
+
+    if (rows <= 0 || cols <= 0 || rows > INT_MAX || cols > INT_MAX ||
+        type < 0 || type > CV_MAKETYPE(CV_DEPTH_MAX - 1, CV_CN_MAX)) {
+        LOG_WARNING("bad binary/mat header, rows: " << rows << ", cols: " << cols << ", type: " << type);
+        return false;
+    }
+
+    if (step != cols * CV_ELEM_SIZE(type) || step > Message::max_frame_size_ / rows ||
+        step * rows != this->image_buffer_length_) {
+        LOG_WARNING("bad binary/mat header, step: " << step << ", content-length: " << this->image_buffer_length_);
+        return false;
+    }
+
+    // pixels in a memfd are used where they are mapped
+    bool is_memfd = this->json_object_.value("content-transfer", "") == "memfd";
+    if (is_memfd && this->mapped_content_ == nullptr) {
+        LOG_WARNING("binary/mat content fd is missing");
+        return false;
+    }
+
+    // pixels lying in one piece in the shm ring are used where the peer wrote them
+    unsigned char* shm_content = is_memfd ? nullptr : this->PeekShmContent();
+
+    if (is_memfd) {
+        this->mat_received_ = cv::Mat((int) rows, (int) cols, (int) type, this->mapped_content_);
+    } else if (shm_content != nullptr) {
+        this->mat_received_ = cv::Mat((int) rows, (int) cols, (int) type, shm_content);
+    } else {
+        // reuses the allocation when the geometry does not change between frames
+        this->mat_received_.create((int) rows, (int) cols, (int) type);
+    }
+
+    if (is_memfd || shm_content != nullptr) {
+        this->content_type_ = "binary/mat";
+        this->json_object_.clear();
+        this->is_image_buffer_loaded_ = true;
+        return true;
+    }
+
+    // bytes which arrived together with the json header
+    long received = std::min(this->recv_buffer_length_, this->image_buffer_length_);
+    memcpy(this->mat_received_.data, &this->recv_buffer_[this->recv_buffer_offset_], received);
+
+    this->recv_buffer_offset_ += received;
+    this->recv_buffer_length_ -= received;
+
+    while (received < this->image_buffer_length_) {
+        long recv_length = this->TransportRecv(this->mat_received_.data + received,
+                                               this->image_buffer_length_ - received);
+        if (recv_length <= 0) {
+            LOG_WARNING("socket received length: " << recv_length << ", remote socket closed, BREAK while loop");
+            return false;
+        }
+        received += recv_length;
+    }
+
+    this->content_type_ = "binary/mat";
+    this->json_object_.clear();
+    this->is_image_buffer_loaded_ = true;
+    return true;
+}
+
+/*!
+ * @brief create socket response message from cv::Mat objects, every buffer involved is reused across frames
+ * @param [in] array_mat_image cv::Mat objects
+ * @param [in] image_count count of array_mat_image
+ * @param [in] is_batch true="binary/image-batch" with an "items" list, false="binary/image" of the first image
+*/
+void Message::CreateResponseBuffer(const cv::Mat* array_mat_image, size_t image_count, bool is_batch) {
+
+    if (!is_batch) {
+        image_count = std::min<size_t>(image_count, 1);
+    }
+    if (image_count == 0) {
+        return;
+    }
+
+    if (this->vector_encoded_images_.size() < image_count) {
+        this->vector_encoded_images_.resize(image_count);
+    }
+
+    auto& vector_iov = this->vector_iov_;
+    vector_iov.clear();
+
+    for (size_t i = 0; i < image_count; i++) {
+        auto& vector_image = this->vector_encoded_images_[i];
+
+        if (!ImageCodec::Encode(array_mat_image[i], this->encode_params_.format, this->imencode_params_, vector_image)) {
+            return;
+        }
+
+        vector_iov.push_back({vector_image.data(), vector_image.size()});
+    }
+
+    this->CreateImageBuffer(vector_iov.data(), image_count, is_batch, true);
+}
+
+/*!
+ * @brief write already encoded images, e.g. jpg files, without decoding and encoding them again
+ * @param [in] array_images encoded images, sent from where they are when not copied into a memfd
+ * @param [in] image_count count of array_images
+ * @param [in] is_batch true="binary/image-batch" with an "items" list, false="binary/image" of the first image
+ * @return true=succeed, false=failed
+*/
+bool Message::WriteEncodedImages(const iovec* array_images, size_t image_count, bool is_batch) {
+    if (this->is_response_created_) {
+        return false;
+    }
+
+    if (!is_batch) {
+        image_count = std::min<size_t>(image_count, 1);
+    }
+
+    long content_length = 0;
+    for (size_t i = 0; i < image_count; i++) {
+        content_length += array_images[i].iov_len;
+    }
+
+    // a memfd takes a copy of the content, otherwise only the header goes into send_buffer_
+    bool is_memfd = this->IsMemfdTransfer(content_length);
+    if (image_count == 0 || !this->CreateImageBuffer(array_images, image_count, is_batch, is_memfd)) {
+        return false;
+    }
+
+    if (is_memfd) {
+        return this->SocketWrite();
+    }
+
+    auto& vector_iov = this->vector_iov_;
+    vector_iov.clear();
+    vector_iov.push_back({this->send_buffer_.data(), (size_t) this->send_buffer_length_});
+    vector_iov.insert(vector_iov.end(), array_images, array_images + image_count);
+
+    return this->SocketWriteVector(vector_iov);
+}
+
+/*!
+ * @brief write the header of an image message into send_buffer_, and the content into send_buffer_ or a memfd
+ * @param [in] array_images encoded images
+ * @param [in] image_count count of array_images
+ * @param [in] is_batch true="binary/image-batch" with an "items" list, false="binary/image"
+ * @param [in] is_content_copied true=copy the content after the header, false=the caller sends the content,
+ *                               a memfd transfer always copies
+ * @return true=succeed, false=failed
+*/
+bool Message::CreateImageBuffer(const iovec* array_images, size_t image_count, bool is_batch, bool is_content_copied) {
+    long content_length = 0;
+    auto& json_items = this->json_items_;
+    json_items.clear();
+
+    for (size_t i = 0; i < image_count; i++) {
+        if (!json_items.empty()) {
+            json_items.append(", ");
+        }
+        json_items.append(R"({"offset": )").append(to_string(content_length))
+                .append(R"(, "length": )").append(to_string(array_images[i].iov_len)).append("}");
+
+        content_length += array_images[i].iov_len;
+    }
+
+    bool is_memfd = this->IsMemfdTransfer(content_length);
+    const char* json_transfer = is_memfd ? R"(, "content-transfer": "memfd")" : "";
+
+    auto& json_string = this->json_header_;
+    if (is_batch) {
+        json_string.assign(R"({"byteorder": "little", "content-type": "binary/image-batch","content-encoding": "binary", "content-length": )")
+                .append(to_string(content_length)).append(json_transfer);
+        this->AppendStream(json_string);
+        json_string.append(R"(, "items": [)").append(json_items).append("]}");
+    } else {
+        json_string.assign(R"({"byteorder": "little", "content-type": "binary/image","content-encoding": "binary", "content-length": )")
+                .append(to_string(content_length)).append(json_transfer);
+        this->AppendStream(json_string);
+        json_string.append("}");
+    }
+
+    const char *json_chars = json_string.c_str();
+    unsigned short short_json_length = json_string.size();
+
+    unsigned char header_chars[sizeof(short_json_length)];
+    Short2Char(header_chars, short_json_length);
+
+    long header_length = sizeof(header_chars);
+
+    bool is_copied_to_buffer = is_content_copied && !is_memfd;
+
+    if (json_string.size() > USHRT_MAX || content_length > Message::max_frame_size_ ||
+        !ReserveBuffer(this->send_buffer_, header_length + short_json_length + (is_copied_to_buffer ? content_length : 0))) {
+        LOG_WARNING("message of " << content_length << " bytes is too large to send");
+        return false;
+    }
+
+    memcpy(&this->send_buffer_[this->send_buffer_length_], header_chars, header_length * sizeof(header_chars[0]));
+    this->send_buffer_length_ += header_length;
+
+    memcpy(&this->send_buffer_[this->send_buffer_length_], json_chars, short_json_length * sizeof(json_chars[0]));
+    this->send_buffer_length_ += short_json_length;
+
+    // images go into a memfd which travels with the header, or follow the header in send_buffer_
+    unsigned char* content = nullptr;
+    if (is_memfd) {
+        content = this->CreateContentFd(content_length);
+        if (content == nullptr) {
+            return false;
+        }
+    }
+
+    long content_offset = 0;
+    for (size_t i = 0; i < image_count; i++) {
+        const auto& image = array_images[i];
+
+        if (is_memfd) {
+            memcpy(&content[content_offset], image.iov_base, image.iov_len);
+            content_offset += image.iov_len;
+        } else if (is_copied_to_buffer) {
+            memcpy(&this->send_buffer_[this->send_buffer_length_], image.iov_base, image.iov_len);
+            this->send_buffer_length_ += image.iov_len;
+        }
+    }
+
+    if (is_memfd) {
+        munmap(content, content_length);
+    }
+
+    this->is_response_created_ = true;
+    return true;
+}
+
+/*!
+ * @brief read the length of json text message
+*/
+void Message::ProcessProtocolHeader() {
+    // make sure to load enough data to get protocol_header
+    if(this->recv_buffer_length_ >= Message::protocol_header_length) {
+
+        // convert char to short, to get json_text_length_
+        this->json_text_length_ = Char2Short(&this->recv_buffer_[this->recv_buffer_offset_]);
+
+        // skip protocol_header data in recv_buffer_
+        this->recv_buffer_offset_ += Message::protocol_header_length;
+        this->recv_buffer_length_ -= Message::protocol_header_length;
+    }
+}
+
+/*!
+ * @brief read the length of binary image
+*/
+void Message::ProcessJsonText() {
+
+    if(this->recv_buffer_length_ >= this->json_text_length_) {
+
+        // get json object from json text, it is not null-terminated in recv_buffer_
+        auto json_text = &this->recv_buffer_[this->recv_buffer_offset_];
+        this->json_object_ = json::parse(json_text, json_text + this->json_text_length_);
+
+        // record the content length of image file
+        this->image_buffer_length_ = (long)this->json_object_["content-length"];
+
+        // control messages belong to the connection, not to a stream
+        if (this->json_object_["content-type"].get_ref<const string&>().compare(0, 8, "control/") != 0) {
+            this->stream_id_ = this->json_object_.value("stream", 0L);
+            this->status_ = this->json_object_.value("status", "");
+
+            // the priority goes back into the answers' headers, so only known classes are kept
+            this->priority_ = this->json_object_.value("priority", "");
+            if (this->priority_ != "critical" && this->priority_ != "normal" && this->priority_ != "bulk") {
+                this->priority_.clear();
+            }
+        }
+
+        // the content of a memfd transfer is not in the stream
+        if (this->json_object_.value("content-transfer", "") == "memfd" && !this->MapReceivedContent()) {
+            LOG_WARNING("failed to map memfd content of " << this->image_buffer_length_ << " bytes");
+        }
+
+        // skip json_text data in recv_buffer_
+        this->recv_buffer_offset_ += this->json_text_length_;
+        this->recv_buffer_length_ -= this->json_text_length_;
+
+        this->is_json_text_loaded_ = true;
+    }
+}
+
+/*!
+ * @brief wait for the whole content in "recv_buffer_" and point content_buffer_ at it, set the length value to "image_buffer_length_"
+*/
+void Message::ProcessContent() {
+
+    if (this->image_buffer_length_ == 0) {
+        this->image_buffer_length_ = (long) this->json_object_["content-length"];
+    }
+
+    bool is_memfd = this->json_object_.value("content-transfer", "") == "memfd";
+    const auto& content_type = this->json_object_["content-type"].get_ref<const string&>();
+    bool is_image = content_type == "binary/image" || content_type == "binary/image-batch";
+
+    // images lying in one piece in the shm ring are decoded there instead of being copied out
+    unsigned char* shm_content = is_image && !is_memfd ? this->PeekShmContent() : nullptr;
+
+    // check data length, the content of a memfd transfer is already mapped
+    if (!is_memfd && shm_content == nullptr && this->image_buffer_length_ > this->recv_buffer_length_) {
+        return;
+    } else {
+        if (is_image && (!is_memfd || this->mapped_content_ != nullptr)) {
+
+            if (is_memfd) {
+                this->content_buffer_ = static_cast<unsigned char*>(this->mapped_content_);
+            } else if (shm_content != nullptr) {
+                this->content_buffer_ = shm_content;
+            } else {
+                // decoders read the content where it was received
+                this->content_buffer_ = &this->recv_buffer_[this->recv_buffer_offset_];
+
+                // skip content data in recv_buffer_
+                this->recv_buffer_offset_ += this->image_buffer_length_;
+                this->recv_buffer_length_ -= this->image_buffer_length_;
+            }
+
+            this->content_type_ = content_type;
+
+            if (content_type == "binary/image") {
+                this->vector_item_offsets_.push_back(0);
+                this->vector_item_lengths_.push_back(this->image_buffer_length_);
+            } else {
+                // every item must lie inside the content, offset and length come from the peer and are not summed
+                for (const auto& item : this->json_object_["items"]) {
+                    auto iter_offset = item.find("offset");
+                    auto iter_length = item.find("length");
+                    if (iter_offset == item.end() || !iter_offset->is_number_integer() ||
+                        iter_length == item.end() || !iter_length->is_number_integer()) {
+                        LOG_WARNING("batch item without an integer offset and length");
+                        continue;
+                    }
+
+                    long offset = iter_offset->get<long>();
+                    long length = iter_length->get<long>();
+
+                    if (offset < 0 || length < 0 || offset > this->image_buffer_length_ ||
+                        length > this->image_buffer_length_ - offset) {
+                        LOG_WARNING("batch item out of range, offset: " << offset << ", length: " << length);
+                        continue;
+                    }
+
+                    this->vector_item_offsets_.push_back(offset);
+                    this->vector_item_lengths_.push_back(length);
+                }
+            }
+
+        } else if ((content_type == "text/json" || content_type == "binary/tensor") &&
+                   (!is_memfd || this->mapped_content_ != nullptr)) {
+
+            auto content = is_memfd ? static_cast<unsigned char*>(this->mapped_content_) :
+                           &this->recv_buffer_[this->recv_buffer_offset_];
+
+            // the content stays where it is until Clear(), only the offset moves on
+            if (!is_memfd) {
+                this->recv_buffer_offset_ += this->image_buffer_length_;
+                this->recv_buffer_length_ -= this->image_buffer_length_;
+            }
+
+            // a content which can not be loaded leaves content_type_ empty, the connection goes on
+            if (this->LoadPayload(content)) {
+                this->content_type_ = content_type;
+            }
+
+        } else if (content_type.compare(0, 8, "control/") == 0) {
+            // control messages carry everything in their json header
+            this->control_json_ = this->json_object_;
+            this->content_type_ = content_type;
+
+        } else {
+            LOG_WARNING("unsupported content_type!");
+
+            // skip the content nobody reads
+            if (!is_memfd) {
+                this->recv_buffer_offset_ += this->image_buffer_length_;
+                this->recv_buffer_length_ -= this->image_buffer_length_;
+            }
+        }
+
+        this->json_object_.clear();
+        this->is_image_buffer_loaded_ = true;
+    }
+
+}
+
+/*!
+ * @brief point content_buffer_ at the content of a "text/json" or "binary/tensor" message, decompressing it
+ *        into decompressed_content_ when the "content-encoding" asks for it
+ * @param [in] content received content of image_buffer_length_ bytes
+ * @return true=loaded, false=unsupported encoding, bad content or bad tensor header
+*/
+bool Message::LoadPayload(const unsigned char* content) {
+    string encoding = this->json_object_.value("content-encoding", "binary");
+
+    if (encoding == "binary") {
+        this->content_buffer_ = const_cast<unsigned char*>(content);
+    } else {
+        long original_length = this->json_object_.value("original-length", 0L);
+
+        if (!PayloadCodec::IsSupported(encoding)) {
+            LOG_WARNING("unsupported content-encoding " << encoding);
+            return false;
+        }
+
+        if (original_length <= 0 || !ReserveBuffer(this->decompressed_content_, original_length) ||
+            !PayloadCodec::Decompress(encoding, content, this->image_buffer_length_,
+                                      this->decompressed_content_.data(), original_length)) {
+            LOG_WARNING("failed to decompress " << encoding << " content of " << this->image_buffer_length_
+                        << " bytes to " << original_length << " bytes");
+            return false;
+        }
+
+        this->content_buffer_ = this->decompressed_content_.data();
+        this->image_buffer_length_ = original_length;
+    }
+
+    if (this->json_object_["content-type"] != "binary/tensor") {
+        return true;
+    }
+
+    // the elements must fill the content exactly
+    this->tensor_dtype_ = this->json_object_.value("dtype", "");
+    long content_length = Message::GetDtypeSize(this->tensor_dtype_);
+
+    auto iter = this->json_object_.find("shape");
+    if (iter != this->json_object_.end() && iter->is_array()) {
+        for (const auto& size : *iter) {
+            long dimension = size.is_number_integer() ? size.get<long>() : -1;
+            if (dimension < 0 || (dimension > 0 && content_length > Message::max_frame_size_ / dimension)) {
+                content_length = -1;
+                break;
+            }
+
+            this->vector_tensor_shape_.push_back(dimension);
+            content_length *= dimension;
+        }
+    }
+
+    if (content_length != this->image_buffer_length_) {
+        LOG_WARNING("bad binary/tensor header, dtype: " << this->tensor_dtype_ << ", content-length: "
+                    << this->image_buffer_length_);
+        this->vector_tensor_shape_.clear();
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief append the "stream" and "priority" fields of a header, left out when not set so single-stream peers
+ *        see no change
+ * @param[in,out] json_string json header without its closing brace
+*/
+void Message::AppendStream(string& json_string) const {
+    if (this->stream_id_ != 0) {
+        json_string.append(R"(, "stream": )").append(to_string(this->stream_id_));
+    }
+
+    if (!this->priority_.empty()) {
+        json_string.append(R"(, "priority": ")").append(this->priority_).append("\"");
+    }
+}
+
+/*!
+ * @brief get the size of one element of a "binary/tensor" dtype
+ * @param[in] dtype element type, e.g. "float32"
+ * @return bytes of one element, 0 = unknown dtype
+*/
+long Message::GetDtypeSize(const string& dtype) {
+    static const map<string, long> map_dtype_sizes = {
+            {"uint8", 1}, {"int8", 1}, {"uint16", 2}, {"int16", 2}, {"float16", 2},
+            {"int32", 4}, {"uint32", 4}, {"float32", 4}, {"int64", 8}, {"uint64", 8}, {"float64", 8}};
+
+    auto iter = map_dtype_sizes.find(dtype);
+    return iter == map_dtype_sizes.end() ? 0 : iter->second;
+}
+
+/*!
+ * @brief grow buffer to hold length bytes, up to max_frame_size_
+ * @param[in,out] buffer buffer to grow, existing data is kept
+ * @param[in] length required length
+ * @return true=buffer holds length bytes, false=length is out of range
+*/
+bool Message::ReserveBuffer(vector<unsigned char>& buffer, long length) {
+    if (length > Message::max_frame_size_) {
+        return false;
+    }
+
+    if ((long) buffer.size() < length) {
+        buffer.resize(std::max<long>(length, buffer.size() * 2));
+    }
+    return true;
+}
+
+/*!
+ * @brief convert short to char*
+ * @param[out] char_str output char* variable
+ * @param[in] short_str input short variable
+*/
+void Message::Short2Char(unsigned char *char_str, unsigned short short_str) {
+    unsigned short s = short_str;
+    for (int x = 0; x < 2; x++) {
+        char_str[x] = s & 0xffu;
+        s = s >> 8u;
+    }
+}
+
+/*!
+ * @brief convert char* to short
+ * @param[in] char_str input char* variable
+ * @return short value
+*/
+unsigned short Message::Char2Short(const unsigned char* char_str) {
+    unsigned short s0 = char_str[0];
+    unsigned short s1 = char_str[1];
+//    unsigned short s0 = char_str[0] | 0xffu;
+//    unsigned short s1 = char_str[1] | 0xffu;
+
+    s1 = s1 << 8u;
+    unsigned short s = (short) (s0 | s1);
+    return s;
+}
+
+Message::~Message() {
+    this->ReleaseReceivedContent();
+
+    for (auto fd : this->deque_received_fds_) {
+        close(fd);
+    }
+
+    if (this->send_fd_ >= 0) {
+        close(this->send_fd_);
+    }
+
     this->imencode_params_.clear();
     vector<int>().swap(this->imencode_params_);
 }
@@ -1,11 +1,14 @@
 #ifndef SERVER_MESSAGE_H
 #define SERVER_MESSAGE_H
 
+#include <climits>
 #include <ctime>
+#include <deque>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -13,12 +16,21 @@
 #include <mutex>
 
 #include "json.hpp"
+#include "encode_params.h"
+#include "image_codec.h"
+#include "logger.h"
+#include "payload_codec.h"
+#include "shm_channel.h"
+#include "zero_copy_sender.h"
 
 using namespace std;
 using namespace cv;
 using namespace std::chrono;
 using json = nlohmann::json;
 
+class TlsContext;
+class TlsSession;
+
 
 class Message {
 
@@ -29,12 +41,68 @@ public:
 
     void GetImageBufferResult(unsigned char*& output_content, long& output_length);
 
+    void GetImageBufferResult(int index, unsigned char*& output_content, long& output_length);
+
+    int GetImageCount() const;
+
+    const string& GetContentType() const;
+
+    long GetStreamId() const;
+
+    void SetStreamId(long stream_id);
+
+    const string& GetPriority() const;
+
+    void SetPriority(const string& priority);
+
+    const string& GetStatus() const;
+
+    bool GetMatResult(cv::Mat& output_mat);
+
+    bool GetJsonResult(json& output_json) const;
+
+    bool GetTensorResult(string& dtype, vector<long>& shape, unsigned char*& output_content, long& output_length) const;
+
     void Clear();
 
     bool Read();
 
     bool WriteImage(const cv::Mat& mat_image);
 
+    bool WriteImages(const vector<cv::Mat>& vector_mat_image);
+
+    bool WriteMat(const cv::Mat& mat_image);
+
+    bool WriteEncodedImages(const iovec* array_images, size_t image_count, bool is_batch);
+
+    bool WriteStatus(const string& status);
+
+    bool WriteJson(const json& json_content);
+
+    bool WriteTensor(const void* data, const string& dtype, const vector<long>& shape);
+
+    bool WriteTensor(const cv::Mat& mat_tensor);
+
+    bool IsReadBuffered() const;
+
+    bool IsShmTransport() const;
+
+    void SetQuickAck(bool is_quick_ack);
+
+    bool SetZeroCopy(bool is_zero_copy);
+
+    bool StartTls(const shared_ptr<TlsContext>& tls_context);
+
+    bool RequestShm(long capacity);
+
+    void SetEncodeParams(const EncodeParams& params);
+
+    void GetImencodeParams(string& format, vector<int>& imencode_params) const;
+
+    bool RequestEncodeParams(const EncodeParams& params);
+
+    bool RequestContentEncoding(const vector<string>& vector_encodings, int level);
+
 
 private:
 
@@ -42,19 +110,50 @@ private:
 
     static const long max_socket_buffer_size_ = max_buffer_size_ * 0.4;
 
+    // upper limit of one frame, buffers grow from max_buffer_size_ up to this size for batches
+    static const long max_frame_size_ = 64 * 1024 * 1024;
+
+    // on a unix socket, contents from this size on are passed as a memfd instead of through the stream
+    static const long memfd_threshold_ = 256 * 1024;
+
+    static const int max_received_fds_ = 4;
+
+    // frames from this size on are sent with MSG_ZEROCOPY when enabled, below it copying is cheaper than
+    // pinning the pages and reading the completion
+    static const long zero_copy_threshold_ = 64 * 1024;
+
+    // most send buffers the kernel may still read from
+    static const int zero_copy_buffer_count_ = 4;
+
+    // "text/json" and "binary/tensor" contents shorter than this are not compressed, it would hardly save a packet
+    static const long compression_threshold_ = 1024;
+
     static const int protocol_header_length = 2;
 
     int socket_fd_;
 
     string client_address_;
 
+    bool is_unix_socket_ = false;
+
+    // set TCP_QUICKACK again after every read, see SocketOptions::is_quick_ack
+    bool is_quick_ack_ = false;
+
     vector<int> imencode_params_;
 
-    unsigned char recv_buffer_[max_buffer_size_]{};
+    EncodeParams encode_params_;
+
+    AdaptiveQuality adaptive_quality_;
 
+    // received bytes, a frame is consumed in place from recv_buffer_offset_ on and its content is never copied out
+    vector<unsigned char> recv_buffer_;
+
+    long recv_buffer_offset_{};
+
+    // count of unconsumed bytes from recv_buffer_offset_ on
     long recv_buffer_length_{};
 
-    unsigned char send_buffer_[max_buffer_size_]{};
+    vector<unsigned char> send_buffer_;
 
     long send_buffer_length_{};
 
@@ -68,15 +167,133 @@ private:
 
     bool is_json_text_loaded_ = false;
 
-    unsigned char image_buffer_[max_buffer_size_]{};
-
     bool is_image_buffer_loaded_ = false;
 
+    // content of the loaded message inside recv_buffer_ or a memfd mapping, valid until Clear()
+    unsigned char* content_buffer_ = nullptr;
+
+    string content_type_;
+
+    // stream of the loaded message, and of the written ones, "stream" in the json header
+    long stream_id_ = 0;
+
+    // priority class of the stream, "priority" in the json header
+    string priority_;
+
+    // "status" of the loaded message, e.g. "dropped", empty for a processed frame
+    string status_;
+
+    // offset and length of each image in content_buffer_, one item for "binary/image"
+    vector<long> vector_item_offsets_;
+
+    vector<long> vector_item_lengths_;
+
+    // encoded images of the response, kept to reuse their capacity
+    vector<vector<uchar>> vector_encoded_images_;
+
+    // json header and "items" list of the response, kept to reuse their capacity
+    string json_header_;
+
+    string json_items_;
+
+    // blocks of a "binary/mat" response, or of the encoded images
+    vector<iovec> vector_iov_;
+
+    // pixels of a "binary/mat" message are received straight into this Mat, it keeps its allocation across frames
+    cv::Mat mat_received_;
+
+    // "content-encoding" of the written "text/json" and "binary/tensor" messages, agreed by "control/compress"
+    string content_encoding_ = "binary";
+
+    // level of content_encoding_, 0 = the library default
+    int compression_level_ = 0;
+
+    // compressed content of the response, and decompressed content of the loaded message, kept to reuse their capacity
+    vector<unsigned char> compressed_content_;
+    vector<unsigned char> decompressed_content_;
+
+    // json text of a "text/json" response, kept to reuse its capacity
+    string json_content_;
+
+    // "dtype" and "shape" of a loaded "binary/tensor" message
+    string tensor_dtype_;
+    vector<long> vector_tensor_shape_;
+
+    // json header of the last "control/..." message
+    json control_json_;
+
+    // frames go through shared memory instead of the socket once negotiated
+    unique_ptr<ShmChannel> shm_channel_;
+
+    // nullptr unless SetZeroCopy() succeeded
+    unique_ptr<ZeroCopySender> zero_copy_sender_;
+
+    // set by StartTls(), records the kernel does not take go through it
+    unique_ptr<TlsSession> tls_session_;
+
+    // fds received with SCM_RIGHTS, taken in order by messages with "content-transfer": "memfd"
+    deque<int> deque_received_fds_;
+
+    void* mapped_content_ = nullptr;
+
+    long mapped_content_length_ = 0;
+
+    // content decoded where it lies in the shm ring, its bytes are handed back to the writer on Clear()
+    unsigned char* shm_content_ = nullptr;
+
+    long shm_content_length_ = 0;
+
+    // memfd sent with the next frame header
+    int send_fd_ = -1;
+
+    bool ReadFrame();
+
     long SocketRead();
 
     bool SocketWrite();
 
-    void CreateResponseBuffer(const cv::Mat& mat_image);
+    bool SocketWriteVector(vector<iovec>& vector_iov);
+
+    bool WriteControl(const string& json_string);
+
+    bool AcceptShm();
+
+    bool HandleControl();
+
+    bool AcceptEncodeParams();
+
+    bool AcceptContentEncoding();
+
+    void UpdateAdaptiveQuality(const steady_clock::time_point& time_begin);
+
+    long TransportRecv(void* buffer, long length);
+
+    long TransportSend(const void* buffer, long length);
+
+    long SendWithFd(const void* buffer, long length);
+
+    bool IsMemfdTransfer(long content_length) const;
+
+    unsigned char* CreateContentFd(long length);
+
+    bool MapReceivedContent();
+
+    void ReleaseReceivedContent();
+
+    unsigned char* PeekShmContent();
+
+    bool ReadMatContent();
+
+    bool WritePayload(const string& content_type, const string& json_fields, const unsigned char* content,
+                      long content_length);
+
+    bool LoadPayload(const unsigned char* content);
+
+    void CreateResponseBuffer(const cv::Mat* array_mat_image, size_t image_count, bool is_batch);
+
+    bool CreateImageBuffer(const iovec* array_images, size_t image_count, bool is_batch, bool is_content_copied);
+
+    void AppendStream(string& json_string) const;
 
     void ProcessProtocolHeader();
 
@@ -84,7 +301,11 @@ private:
 
     void ProcessContent();
 
-    static void Short2Char(unsigned char* char_str, unsigned char short_str);
+    static long GetDtypeSize(const string& dtype);
+
+    static bool ReserveBuffer(vector<unsigned char>& buffer, long length);
+
+    static void Short2Char(unsigned char* char_str, unsigned short short_str);
 
     static unsigned short Char2Short(const unsigned char* char_str);
 
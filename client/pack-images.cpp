@@ -0,0 +1,65 @@
+#include <fstream>
+#include <iterator>
+#include "file_walker.h"
+#include "image_pack.h"
+#include "logger.h"
+
+using namespace std;
+
+
+// packs the jpg files of a folder into one file for Client::StartPack(), the files are stored as they are
+// usage: pack-images <folder> <pack file> [--recursive]
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        LOG_ERROR("usage: " << argv[0] << " <folder> <pack file> [--recursive]");
+        return 1;
+    }
+
+    string folder_path = argv[1];
+    string pack_path = argv[2];
+
+    // the pack is replayed in this order
+    FileWalkerOptions options;
+    options.is_recursive = argc > 3 && string(argv[3]) == "--recursive";
+    options.is_sorted = true;
+
+    FileWalker file_walker(options);
+    file_walker.Start(folder_path);
+
+    ImagePackWriter pack_writer;
+    if (!pack_writer.Open(pack_path)) {
+        return 1;
+    }
+
+    long file_count = 0;
+    long byte_count = 0;
+    vector<char> vector_data;
+    string file_path;
+
+    while (file_walker.Next(file_path)) {
+        std::ifstream file(file_path, std::ios::binary);
+        if (!file) {
+            LOG_WARNING("failed to read " << file_path);
+            continue;
+        }
+        vector_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        // names are relative to the folder, like the lines of a manifest
+        string name = file_path.compare(0, folder_path.size() + 1, folder_path + "/") == 0 ?
+                      file_path.substr(folder_path.size() + 1) : file_path;
+
+        if (!pack_writer.Add(name, vector_data.data(), vector_data.size())) {
+            return 1;
+        }
+
+        file_count++;
+        byte_count += vector_data.size();
+    }
+
+    if (!pack_writer.Finish()) {
+        return 1;
+    }
+
+    LOG_INFO("packed " << file_count << " files, " << byte_count << " bytes into " << pack_path);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "prefetch_loader.h"
+
+/*!
+ * @brief init PrefetchLoader and start its threads
+ * @param[in] file_walker stream of files to load, must outlive the loader
+ * @param[in] thread_count count of loader threads, 0 loads each file in Take() on the calling thread
+ * @param[in] depth most files loaded ahead of Take()
+ * @param[in] load_function loads one file, e.g. read and resize
+*/
+PrefetchLoader::PrefetchLoader(FileWalker& file_walker, int thread_count, int depth,
+                               LoadFunction load_function) : file_walker_(file_walker) {
+    this->load_function_ = std::move(load_function);
+    this->depth_ = std::max(depth, 1);
+
+    for (int i = 0; i < thread_count; i++) {
+        this->vector_threads_.emplace_back(&PrefetchLoader::LoadHandle, this);
+    }
+}
+
+/*!
+ * @brief stop the loader threads, files not loaded yet are skipped
+*/
+PrefetchLoader::~PrefetchLoader() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_slots_);
+        this->is_stopped_ = true;
+    }
+    this->cv_taken_.notify_all();
+
+    for (auto& item : this->vector_threads_) {
+        item.join();
+    }
+}
+
+/*!
+ * @brief wait for a file and move its image out
+ * @param[in] index index of the file in the stream, each index is taken once
+ * @param[out] output loaded image, or file contents
+ * @param[out] file_path path of the file
+ * @return Loaded, Failed, or End when index is past the last file
+*/
+PrefetchLoader::TakeStatus PrefetchLoader::Take(long index, LoadedImage& output, string& file_path) {
+    // without loader threads, the caller loads the file itself
+    if (this->vector_threads_.empty()) {
+        if (!this->Pull(index)) {
+            return TakeStatus::End;
+        }
+
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_slots_);
+            auto iter = this->map_slots_.find(index);
+            file_path = std::move(iter->second.file_path);
+            this->map_slots_.erase(iter);
+        }
+
+        return this->load_function_(file_path, output) ? TakeStatus::Loaded : TakeStatus::Failed;
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex_slots_);
+
+    this->cv_loaded_.wait(lock, [this, index] {
+        auto iter = this->map_slots_.find(index);
+        return (iter != this->map_slots_.end() && iter->second.state != SlotState::Pending) ||
+               index >= this->file_count_;
+    });
+
+    auto iter = this->map_slots_.find(index);
+    if (iter == this->map_slots_.end()) {
+        return TakeStatus::End;
+    }
+
+    bool is_loaded = iter->second.state == SlotState::Loaded;
+    output = std::move(iter->second.image);
+    file_path = std::move(iter->second.file_path);
+    this->map_slots_.erase(iter);
+
+    this->taken_count_++;
+    lock.unlock();
+
+    this->cv_taken_.notify_all();
+    return is_loaded ? TakeStatus::Loaded : TakeStatus::Failed;
+}
+
+/*!
+ * @brief pull paths from the walker until index has a slot
+ * @param[in] index index of the file in the stream
+ * @return true=index has a slot, false=the stream ended before index
+*/
+bool PrefetchLoader::Pull(long index) {
+    std::lock_guard<std::mutex> lockGuardPull(this->mutex_pull_);
+
+    while (this->pulled_count_ <= index) {
+        string file_path;
+        bool is_pulled = this->file_walker_.Next(file_path);
+
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_slots_);
+            if (!is_pulled) {
+                this->file_count_ = this->pulled_count_;
+            } else {
+                this->map_slots_[this->pulled_count_].file_path = std::move(file_path);
+            }
+        }
+
+        if (!is_pulled) {
+            this->cv_loaded_.notify_all();
+            return false;
+        }
+        this->pulled_count_++;
+    }
+    return true;
+}
+
+/*!
+ * @brief loader thread, loads files in stream order while less than depth_ files wait
+*/
+void PrefetchLoader::LoadHandle() {
+    while (true) {
+        long index;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_slots_);
+            this->cv_taken_.wait(lock, [this] {
+                return this->is_stopped_ || this->next_load_index_ < this->taken_count_ + this->depth_;
+            });
+
+            if (this->is_stopped_ || this->next_load_index_ >= this->file_count_) {
+                return;
+            }
+            index = this->next_load_index_++;
+        }
+
+        if (!this->Pull(index)) {
+            return;
+        }
+
+        string file_path;
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_slots_);
+            file_path = this->map_slots_[index].file_path;
+        }
+
+        LoadedImage image;
+        bool is_loaded = this->load_function_(file_path, image);
+
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_slots_);
+            auto& slot = this->map_slots_[index];
+            slot.image = std::move(image);
+            slot.state = is_loaded ? SlotState::Loaded : SlotState::Failed;
+        }
+        this->cv_loaded_.notify_all();
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef CLIENT_PREFETCH_LOADER_H
+#define CLIENT_PREFETCH_LOADER_H
+
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "file_walker.h"
+
+using namespace std;
+
+
+// a loaded file, decoded and resized, or its bytes when they are sent as they are
+struct LoadedImage {
+    cv::Mat mat_image;
+
+    // file contents, set instead of mat_image
+    vector<unsigned char> vector_encoded;
+
+    bool IsEncoded() const { return !this->vector_encoded.empty(); }
+};
+
+
+// loads files ahead of the senders on a pool of threads, at most depth files wait in memory
+class PrefetchLoader {
+
+public:
+    using LoadFunction = function<bool(const string& file_path, LoadedImage& output)>;
+
+    enum class TakeStatus : int {
+        Loaded = 0,
+        // the file exists in the stream but failed to load
+        Failed = 1,
+        // index is past the last file
+        End = 2
+    };
+
+    PrefetchLoader(FileWalker& file_walker, int thread_count, int depth, LoadFunction load_function);
+
+    ~PrefetchLoader();
+
+    TakeStatus Take(long index, LoadedImage& output, string& file_path);
+
+private:
+
+    enum class SlotState : int {
+        Pending = 0,
+        Loaded = 1,
+        Failed = 2
+    };
+
+    struct Slot {
+        string file_path;
+        LoadedImage image;
+        SlotState state = SlotState::Pending;
+    };
+
+    FileWalker& file_walker_;
+
+    LoadFunction load_function_;
+
+    long depth_;
+
+    // files pulled from the walker and not taken yet
+    map<long, Slot> map_slots_;
+
+    // count of paths pulled from the walker, guarded by mutex_pull_
+    long pulled_count_ = 0;
+
+    // count of files in the stream, known once the walker has ended
+    long file_count_ = LONG_MAX;
+
+    // index of the next file to load
+    long next_load_index_ = 0;
+
+    // count of files taken, loaders stay less than depth_ files ahead of it
+    long taken_count_ = 0;
+
+    bool is_stopped_ = false;
+
+    // keeps paths in walker order while several threads pull
+    mutex mutex_pull_;
+
+    mutex mutex_slots_;
+
+    condition_variable cv_loaded_;
+
+    condition_variable cv_taken_;
+
+    vector<thread> vector_threads_;
+
+    bool Pull(long index);
+
+    void LoadHandle();
+};
+
+#endif //CLIENT_PREFETCH_LOADER_H
@@ -0,0 +1,146 @@
+#include "result_sink.h"
+#include "logger.h"
+
+/*!
+ * @brief drop a response
+*/
+void DiscardSink::Put(long file_index, const string& file_path, const cv::Mat& mat_image) {
+    (void) file_index;
+    (void) file_path;
+    (void) mat_image;
+}
+
+/*!
+ * @brief init DisplaySink
+ * @param[in] window_name name of the highgui window
+ * @param[in] wait_ms milliseconds of cv::waitKey after each image
+*/
+DisplaySink::DisplaySink(const string& window_name, int wait_ms) {
+    this->window_name_ = window_name;
+    this->wait_ms_ = wait_ms;
+}
+
+/*!
+ * @brief show a response
+ * @param[in] file_index index of the request file
+ * @param[in] file_path path of the request file
+ * @param[in] mat_image response image
+*/
+void DisplaySink::Put(long file_index, const string& file_path, const cv::Mat& mat_image) {
+    (void) file_index;
+    (void) file_path;
+
+    if (mat_image.empty()) {
+        return;
+    }
+
+    cv::imshow(this->window_name_, mat_image);
+    cv::waitKey(this->wait_ms_);
+}
+
+/*!
+ * @brief init DiskSink
+ * @param[in] folder_path existing folder to write into
+ * @param[in] format extension of the written files, e.g. ".jpg" or ".png"
+*/
+DiskSink::DiskSink(const string& folder_path, const string& format) {
+    this->folder_path_ = folder_path;
+    this->format_ = format;
+}
+
+/*!
+ * @brief write a response to folder_path_, "a/b/img1.jpg" becomes "<folder_path_>/img1<format_>"
+ * @param[in] file_index index of the request file
+ * @param[in] file_path path of the request file
+ * @param[in] mat_image response image
+*/
+void DiskSink::Put(long file_index, const string& file_path, const cv::Mat& mat_image) {
+    (void) file_index;
+
+    if (mat_image.empty()) {
+        return;
+    }
+
+    auto name_begin = file_path.find_last_of('/');
+    string file_name = name_begin == string::npos ? file_path : file_path.substr(name_begin + 1);
+
+    auto extension_begin = file_name.find_last_of('.');
+    if (extension_begin != string::npos) {
+        file_name.resize(extension_begin);
+    }
+
+    string output_path = this->folder_path_ + "/" + file_name + this->format_;
+    if (!cv::imwrite(output_path, mat_image)) {
+        LOG_WARNING("failed to write " << output_path);
+    }
+}
+
+/*!
+ * @brief fold the size and pixels of a response into the checksum
+ * @param[in] file_index index of the request file
+ * @param[in] file_path path of the request file
+ * @param[in] mat_image response image
+*/
+void ChecksumSink::Put(long file_index, const string& file_path, const cv::Mat& mat_image) {
+    (void) file_index;
+    (void) file_path;
+
+    int header[] = {mat_image.rows, mat_image.cols, mat_image.type()};
+    auto header_bytes = reinterpret_cast<const unsigned char*>(header);
+
+    for (size_t i = 0; i < sizeof(header); i++) {
+        this->checksum_ = (this->checksum_ ^ header_bytes[i]) * ChecksumSink::fnv_prime_;
+    }
+
+    // row by row, the padding of a non-continuous Mat is skipped
+    long row_length = mat_image.cols * mat_image.elemSize();
+    for (int row = 0; row < mat_image.rows; row++) {
+        const unsigned char* data = mat_image.ptr(row);
+        for (long i = 0; i < row_length; i++) {
+            this->checksum_ = (this->checksum_ ^ data[i]) * ChecksumSink::fnv_prime_;
+        }
+    }
+
+    this->count_++;
+}
+
+/*!
+ * @brief log the checksum
+*/
+void ChecksumSink::Finish() {
+    LOG_INFO("checksum of " << this->count_ << " images: " << std::hex << this->checksum_);
+}
+
+/*!
+ * @brief get the checksum of every response so far
+ * @return FNV-1a hash
+*/
+unsigned long ChecksumSink::GetChecksum() const {
+    return this->checksum_;
+}
+
+/*!
+ * @brief get the count of responses so far
+ * @return count of images
+*/
+long ChecksumSink::GetCount() const {
+    return this->count_;
+}
+
+/*!
+ * @brief init CallbackSink
+ * @param[in] callback called with every response
+*/
+CallbackSink::CallbackSink(Callback callback) {
+    this->callback_ = std::move(callback);
+}
+
+/*!
+ * @brief pass a response to the callback
+ * @param[in] file_index index of the request file
+ * @param[in] file_path path of the request file
+ * @param[in] mat_image response image
+*/
+void CallbackSink::Put(long file_index, const string& file_path, const cv::Mat& mat_image) {
+    this->callback_(file_index, file_path, mat_image);
+}
@@ -0,0 +1,99 @@
+#ifndef CLIENT_RESULT_SINK_H
+#define CLIENT_RESULT_SINK_H
+
+#include <functional>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+
+
+// receives the responses of Client::Start in file order, on the thread which called Start()
+class ResultSink {
+
+public:
+    virtual ~ResultSink() = default;
+
+    virtual void Put(long file_index, const string& file_path, const cv::Mat& mat_image) = 0;
+
+    // called once after the last response
+    virtual void Finish() {}
+};
+
+
+// drops every response, the default, for benchmarks and batch jobs
+class DiscardSink : public ResultSink {
+
+public:
+    void Put(long file_index, const string& file_path, const cv::Mat& mat_image) override;
+};
+
+
+// shows every response in a highgui window, needs a display
+class DisplaySink : public ResultSink {
+
+public:
+    explicit DisplaySink(const string& window_name = "client", int wait_ms = 1);
+
+    void Put(long file_index, const string& file_path, const cv::Mat& mat_image) override;
+
+private:
+    string window_name_;
+
+    int wait_ms_;
+};
+
+
+// writes every response to a folder, under the name of its request file
+class DiskSink : public ResultSink {
+
+public:
+    explicit DiskSink(const string& folder_path, const string& format = ".jpg");
+
+    void Put(long file_index, const string& file_path, const cv::Mat& mat_image) override;
+
+private:
+    string folder_path_;
+
+    string format_;
+};
+
+
+// folds the pixels of every response into one FNV-1a hash, to compare runs without keeping images
+class ChecksumSink : public ResultSink {
+
+public:
+    void Put(long file_index, const string& file_path, const cv::Mat& mat_image) override;
+
+    void Finish() override;
+
+    unsigned long GetChecksum() const;
+
+    long GetCount() const;
+
+private:
+    static const unsigned long fnv_offset_basis_ = 14695981039346656037UL;
+
+    static const unsigned long fnv_prime_ = 1099511628211UL;
+
+    unsigned long checksum_ = fnv_offset_basis_;
+
+    long count_ = 0;
+};
+
+
+// passes every response to a function
+class CallbackSink : public ResultSink {
+
+public:
+    using Callback = function<void(long file_index, const string& file_path, const cv::Mat& mat_image)>;
+
+    explicit CallbackSink(Callback callback);
+
+    void Put(long file_index, const string& file_path, const cv::Mat& mat_image) override;
+
+private:
+    Callback callback_;
+};
+
+#endif //CLIENT_RESULT_SINK_H
@@ -0,0 +1,49 @@
+#include "socket_address.h"
+
+#include <cstddef>
+#include <cstring>
+
+/*!
+ * @brief check whether address is a unix socket endpoint
+ * @param[in] address endpoint string
+ * @return true=unix socket, false=tcp
+*/
+bool SocketAddress::IsUnix(const string& address) {
+    return address.compare(0, SocketAddress::unix_prefix_length_, "unix:") == 0;
+}
+
+/*!
+ * @brief check whether address is in the abstract namespace, such a socket leaves no file behind
+ * @param[in] address endpoint string
+ * @return true=abstract namespace
+*/
+bool SocketAddress::IsAbstract(const string& address) {
+    return SocketAddress::IsUnix(address) && address.size() > SocketAddress::unix_prefix_length_ &&
+           address[SocketAddress::unix_prefix_length_] == '@';
+}
+
+/*!
+ * @brief fill sockaddr_un from a "unix:..." endpoint
+ * @param[in] address endpoint string
+ * @param[out] unix_addr socket address
+ * @return length of unix_addr for bind() and connect(), 0 if the path is empty or too long
+*/
+socklen_t SocketAddress::MakeUnix(const string& address, struct sockaddr_un& unix_addr) {
+    string path = address.substr(SocketAddress::unix_prefix_length_);
+
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+
+    if (path.empty() || path.size() >= sizeof(unix_addr.sun_path)) {
+        return 0;
+    }
+
+    if (SocketAddress::IsAbstract(address)) {
+        // a leading '\0' selects the abstract namespace, the name is not null-terminated
+        memcpy(&unix_addr.sun_path[1], path.c_str() + 1, path.size() - 1);
+        return offsetof(struct sockaddr_un, sun_path) + path.size();
+    }
+
+    memcpy(unix_addr.sun_path, path.c_str(), path.size());
+    return sizeof(unix_addr);
+}
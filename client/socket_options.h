@@ -0,0 +1,34 @@
+#ifndef CLIENT_SOCKET_OPTIONS_H
+#define CLIENT_SOCKET_OPTIONS_H
+
+#include <string>
+
+using namespace std;
+
+
+// tuning of the sockets of a connection, set on listening, accepted and connecting sockets,
+// 0 / false keeps the default of the kernel
+struct SocketOptions {
+    // send a short write, e.g. the json header before its content, at once instead of waiting for an ack (Nagle)
+    bool is_no_delay = true;
+
+    // ack every read at once instead of delaying the ack, the kernel turns this off again so it is set after each read
+    bool is_quick_ack = false;
+
+    // bytes of the send and receive buffers of the kernel, 0 = autotuned, set on the listening socket too
+    // because the window scale is chosen while connecting
+    int send_buffer_size = 0;
+
+    int receive_buffer_size = 0;
+
+    // micro seconds a blocking read polls the device queue before sleeping, may need CAP_NET_ADMIN
+    int busy_poll_us = 0;
+
+    bool Apply(int socket_fd) const;
+
+private:
+
+    static bool SetOption(int socket_fd, int level, int name, int value, const string& option_name);
+};
+
+#endif //CLIENT_SOCKET_OPTIONS_H
@@ -5,12 +5,16 @@ using namespace std;
 
 
 int main() {
-    cout << "socket client is starting..." << endl;
+    LOG_INFO("socket client is starting...");
 
     string address1 = "127.0.0.1";
-    Client client = Client(address1, 65432);
+    ClientOptions options;
+    // show the responses, needs a display
+    // options.result_sink = make_shared<DisplaySink>();
 
-    cout << address1 << endl;
+    Client client(address1, 65432, options);
+
+    LOG_INFO(address1);
 
 //    client.Start("/home/dyh/workspace/datasets/coco/val2017");
     client.Start("/home/dyh/workspace/unbox/unbox_cpp_caffe2/python_project/images/train");
@@ -0,0 +1,293 @@
+#include "zero_copy_sender.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+
+// from linux 4.14 on, older headers lack them
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/*!
+ * @brief init ZeroCopySender of a socket with SO_ZEROCOPY set
+ * @param[in] socket_fd tcp socket
+ * @param[in] max_buffer_count most buffers in flight before a send waits for the kernel
+*/
+ZeroCopySender::ZeroCopySender(int socket_fd, int max_buffer_count) {
+    this->socket_fd_ = socket_fd;
+    this->max_buffer_count_ = std::max(max_buffer_count, 1);
+}
+
+/*!
+ * @brief free the buffers, the socket may be closed already so completions still queued are not read
+*/
+ZeroCopySender::~ZeroCopySender() {
+    if (this->copied_count_ > 0) {
+        LOG_DEBUG(this->copied_count_ << " of " << this->next_id_ << " zero-copy sends were copied by the kernel");
+    }
+}
+
+/*!
+ * @brief allow MSG_ZEROCOPY on a socket
+ * @param[in] socket_fd tcp socket
+ * @return true=succeed, false=the kernel does not support it
+*/
+bool ZeroCopySender::Enable(int socket_fd) {
+    int value = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == -1) {
+        LOG_WARNING("failed to set SO_ZEROCOPY, error: " << errno);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief send a buffer without copying it, the buffer is kept until the kernel is done and replaced by a free one
+ * @param[in,out] buffer bytes to send, replaced by a buffer done with or an empty one
+ * @param[in] length count of bytes to send from the start of buffer
+ * @return true=succeed, false=failed
+*/
+bool ZeroCopySender::SendBuffer(vector<unsigned char>& buffer, long length) {
+    vector<iovec> vector_iov{{buffer.data(), (size_t) length}};
+
+    unsigned long first_id = this->next_id_;
+    bool is_sent = this->SendIov(vector_iov);
+
+    // every send fell back to copying, the buffer is free already
+    if (this->next_id_ == first_id) {
+        return is_sent;
+    }
+
+    InFlight in_flight;
+    in_flight.last_id = this->next_id_ - 1;
+    in_flight.buffer.swap(buffer);
+    this->deque_in_flight_.push_back(std::move(in_flight));
+
+    this->Reap(false);
+    this->Release();
+
+    // the pool is bounded, wait for the oldest buffer rather than allocate another one
+    while (this->vector_free_buffers_.empty() && this->deque_in_flight_.size() >= this->max_buffer_count_) {
+        if (!this->Reap(true)) {
+            break;
+        }
+        this->Release();
+    }
+
+    if (!this->vector_free_buffers_.empty()) {
+        buffer.swap(this->vector_free_buffers_.back());
+        this->vector_free_buffers_.pop_back();
+    }
+
+    return is_sent;
+}
+
+/*!
+ * @brief send blocks owned by the caller without copying them, and wait until the kernel is done with them
+ * @param[in,out] vector_iov blocks to send, consumed while sending
+ * @return true=succeed, false=failed
+*/
+bool ZeroCopySender::SendVector(vector<iovec>& vector_iov) {
+    bool is_sent = this->SendIov(vector_iov);
+
+    // the caller may write the blocks again once this returns
+    while (is_sent && this->completed_id_ < this->next_id_) {
+        is_sent = this->Reap(true);
+    }
+    this->Release();
+
+    return is_sent;
+}
+
+/*!
+ * @brief get the count of sends the kernel copied after all, zero copy only pays off when this stays low
+ * @return count of copied sends
+*/
+long ZeroCopySender::GetCopiedCount() const {
+    return this->copied_count_;
+}
+
+/*!
+ * @brief sendmsg() with MSG_ZEROCOPY, waiting for completions while the kernel is out of notification memory
+ * @param[in] msg message to send
+ * @return count of bytes, <= 0 means error
+*/
+long ZeroCopySender::SendMessage(struct msghdr& msg) {
+    while (true) {
+        long length = sendmsg(this->socket_fd_, &msg, MSG_ZEROCOPY);
+        if (length > 0) {
+            this->next_id_++;
+            return length;
+        }
+
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+
+        // optmem of the socket is used up by pending notifications
+        if (length == -1 && errno == ENOBUFS) {
+            if (this->completed_id_ < this->next_id_) {
+                if (!this->Reap(true)) {
+                    return -1;
+                }
+                continue;
+            }
+            return sendmsg(this->socket_fd_, &msg, 0);
+        }
+
+        return length;
+    }
+}
+
+/*!
+ * @brief send blocks with as many sendmsg() as needed
+ * @param[in,out] vector_iov blocks to send, consumed while sending
+ * @return true=succeed, false=failed
+*/
+bool ZeroCopySender::SendIov(vector<iovec>& vector_iov) {
+    size_t iov_index = 0;
+
+    while (iov_index < vector_iov.size()) {
+        struct msghdr msg{};
+        msg.msg_iov = &vector_iov[iov_index];
+        msg.msg_iovlen = std::min<size_t>(vector_iov.size() - iov_index, IOV_MAX);
+
+        long length = this->SendMessage(msg);
+        if (length <= 0) {
+            return false;
+        }
+
+        // skip the blocks already sent, and move into a partly sent block
+        while (length > 0 && iov_index < vector_iov.size()) {
+            auto& iov = vector_iov[iov_index];
+            if ((size_t) length >= iov.iov_len) {
+                length -= iov.iov_len;
+                iov_index++;
+            } else {
+                iov.iov_base = (char *) iov.iov_base + length;
+                iov.iov_len -= length;
+                length = 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * @brief read the completions of the error queue
+ * @param[in] is_blocking true=wait until at least one completion arrives
+ * @return true=succeed, false=socket error
+*/
+bool ZeroCopySender::Reap(bool is_blocking) {
+    bool is_reaped = false;
+    bool is_error_polled = false;
+
+    while (true) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+
+        struct msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(this->socket_fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_WARNING("failed to read the error queue, error: " << errno);
+                return false;
+            }
+            if (is_reaped || !is_blocking) {
+                return true;
+            }
+
+            // POLLERR with nothing in the error queue is an error of the socket itself
+            if (is_error_polled) {
+                return false;
+            }
+
+            // a queued completion makes the socket report POLLERR
+            struct pollfd poll_fd{this->socket_fd_, 0, 0};
+            if (poll(&poll_fd, 1, 1000) == -1 && errno != EINTR) {
+                perror("Error: poll");
+                return false;
+            }
+            if (poll_fd.revents & (POLLHUP | POLLNVAL)) {
+                return false;
+            }
+            is_error_polled = (poll_fd.revents & POLLERR) != 0;
+            continue;
+        }
+
+        is_error_polled = false;
+
+        for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool is_recv_error = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                                 (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!is_recv_error) {
+                continue;
+            }
+
+            auto serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                this->copied_count_++;
+            }
+
+            // the kernel reports 32 bit ids, they are taken as the ones following completed_id_
+            auto base = (uint32_t) this->completed_id_;
+            this->Complete(this->completed_id_ + (uint32_t) (serr->ee_info - base),
+                           this->completed_id_ + (uint32_t) (serr->ee_data - base) + 1);
+            is_reaped = true;
+        }
+    }
+}
+
+/*!
+ * @brief record a range of completed sends
+ * @param[in] first_id first completed id
+ * @param[in] end_id last completed id + 1
+*/
+void ZeroCopySender::Complete(unsigned long first_id, unsigned long end_id) {
+    auto& end_value = this->map_completed_ranges_[first_id];
+    end_value = std::max(end_value, end_id);
+
+    // ranges from the watermark on join it, later ones wait for the gap to close
+    auto iter = this->map_completed_ranges_.begin();
+    while (iter != this->map_completed_ranges_.end() && iter->first <= this->completed_id_) {
+        this->completed_id_ = std::max(this->completed_id_, iter->second);
+        iter = this->map_completed_ranges_.erase(iter);
+    }
+}
+
+/*!
+ * @brief move the buffers whose sends are complete to the free buffers
+*/
+void ZeroCopySender::Release() {
+    while (!this->deque_in_flight_.empty() && this->deque_in_flight_.front().last_id < this->completed_id_) {
+        this->vector_free_buffers_.push_back(std::move(this->deque_in_flight_.front().buffer));
+        this->deque_in_flight_.pop_front();
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef CLIENT_ZERO_COPY_SENDER_H
+#define CLIENT_ZERO_COPY_SENDER_H
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+using namespace std;
+
+
+// sends with MSG_ZEROCOPY, the kernel reads the pages of a buffer while it is on the wire instead of copying it,
+// so a buffer is only written again once the error queue of the socket reports its sends complete
+class ZeroCopySender {
+
+public:
+    ZeroCopySender(int socket_fd, int max_buffer_count);
+
+    ~ZeroCopySender();
+
+    static bool Enable(int socket_fd);
+
+    bool SendBuffer(vector<unsigned char>& buffer, long length);
+
+    bool SendVector(vector<iovec>& vector_iov);
+
+    long GetCopiedCount() const;
+
+private:
+
+    // a sent buffer the kernel may still read
+    struct InFlight {
+        // id of the last send of the buffer
+        unsigned long last_id = 0;
+
+        vector<unsigned char> buffer;
+    };
+
+    int socket_fd_;
+
+    // most buffers in flight, a sender waits for completions beyond this
+    size_t max_buffer_count_;
+
+    // id of the next send with MSG_ZEROCOPY, the kernel counts them per socket from 0
+    unsigned long next_id_ = 0;
+
+    // every send below this id is complete
+    unsigned long completed_id_ = 0;
+
+    // completed ranges after a gap, <first id, last id + 1>
+    map<unsigned long, unsigned long> map_completed_ranges_;
+
+    // oldest first
+    deque<InFlight> deque_in_flight_;
+
+    // buffers done with, handed out for the next frames
+    vector<vector<unsigned char>> vector_free_buffers_;
+
+    // count of sends the kernel copied after all, e.g. over loopback
+    long copied_count_ = 0;
+
+    long SendMessage(struct msghdr& msg);
+
+    bool SendIov(vector<iovec>& vector_iov);
+
+    bool Reap(bool is_blocking);
+
+    void Complete(unsigned long first_id, unsigned long end_id);
+
+    void Release();
+};
+
+#endif //CLIENT_ZERO_COPY_SENDER_H
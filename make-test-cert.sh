@@ -0,0 +1,24 @@
+#!/bin/bash
+# generate a test CA and a certificate of the server for 127.0.0.1 and localhost, for TlsOptions of server and client
+# usage: bash make-test-cert.sh [directory], default ./certs
+
+set -e
+
+dir=${1:-./certs}
+mkdir -p "$dir"
+cd "$dir"
+
+echo "#################### CA ####################"
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 -subj "/CN=cpp_socket_demo test CA" \
+    -keyout ca.key -out ca.crt
+
+echo "#################### server ####################"
+openssl req -newkey rsa:2048 -nodes -subj "/CN=localhost" -keyout server.key -out server.csr
+printf "subjectAltName=IP:127.0.0.1,DNS:localhost\n" > server.ext
+openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial -days 365 \
+    -extfile server.ext -out server.crt
+rm -f server.csr server.ext
+
+echo "#################### done ####################"
+echo "server: cert_path=$dir/server.crt key_path=$dir/server.key"
+echo "client: ca_path=$dir/ca.crt server_name=localhost"
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <netinet/in.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "server.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+/*!
+ * @brief connect to a server of this process, retrying while it starts
+ * @param[in] port port of the server
+ * @return socket fd, -1 means failed
+*/
+static int Connect(int port) {
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    for (int i = 0; i < 100; i++) {
+        int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(socket_fd, (struct sockaddr *)& server_addr, sizeof(server_addr)) == 0) {
+            return socket_fd;
+        }
+        close(socket_fd);
+        this_thread::sleep_for(milliseconds(50));
+    }
+    return -1;
+}
+
+/*!
+ * @brief send frames in lock-step until the time is up and record the round trip of each
+ * @param[in] port port of the server
+ * @param[in] vector_image encoded image of every frame
+ * @param[in] time_end time to stop sending
+ * @param[out] vector_latencies round trip of every frame, in micro seconds
+*/
+static void LoadHandle(int port, const vector<uchar>& vector_image, steady_clock::time_point time_end,
+                       vector<double>& vector_latencies) {
+    int socket_fd = Connect(port);
+    if (socket_fd == -1) {
+        LOG_ERROR("failed to connect to port " << port);
+        return;
+    }
+
+    {
+        Message message(socket_fd, "benchmark");
+        iovec image = {(void*) vector_image.data(), vector_image.size()};
+
+        while (true) {
+            auto time_begin = steady_clock::now();
+            if (time_begin >= time_end) {
+                break;
+            }
+
+            message.Clear();
+            if (!message.WriteEncodedImages(&image, 1, false) || !message.Read()) {
+                break;
+            }
+            vector_latencies.push_back(duration_cast<microseconds>(steady_clock::now() - time_begin).count());
+        }
+    }
+
+    close(socket_fd);
+}
+
+/*!
+ * @brief read a field of /proc/self/status
+ * @param[in] name name of the field, e.g. "VmRSS"
+ * @return value in kB, 0 if not found
+*/
+static long ReadStatusKb(const string& name) {
+    std::ifstream file("/proc/self/status");
+    string line;
+
+    while (std::getline(file, line)) {
+        if (line.compare(0, name.size() + 1, name + ":") == 0) {
+            return atol(line.c_str() + name.size() + 1);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief count the resident pages of this process on each NUMA node
+ * @return pages by node, empty when the kernel shows no numa_maps
+*/
+static map<int, long> ReadNodePages() {
+    map<int, long> map_pages;
+
+    std::ifstream file("/proc/self/numa_maps");
+    string line;
+
+    // each mapping lists its pages per node as "N0=12 N1=3"
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        string token;
+
+        while (stream >> token) {
+            size_t equal = token.find('=');
+            if (token.size() > 1 && token[0] == 'N' && isdigit(token[1]) && equal != string::npos) {
+                map_pages[atoi(token.c_str() + 1)] += atol(token.c_str() + equal + 1);
+            }
+        }
+    }
+    return map_pages;
+}
+
+/*!
+ * @brief start a server, load it and print latency and memory, in a child process so runs do not share memory
+ * @param[in] name name of the run
+ * @param[in] options options of the server
+ * @param[in] connection_count count of loading connections
+ * @param[in] seconds duration of the load
+ * @param[in] vector_image encoded image of every frame
+*/
+static void RunPlacement(const string& name, const ServerOptions& options, int connection_count, int seconds,
+                         const vector<uchar>& vector_image) {
+    // the parent runs no thread of its own, nothing is logged before this, so the child starts clean
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error: fork");
+        return;
+    }
+
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    // Server::Start never returns, the child exits when the load is done
+    int port = 41000;
+    auto server = new Server("127.0.0.1", port, 60, options);
+    thread(&Server::Start, server).detach();
+
+    auto time_end = steady_clock::now() + std::chrono::seconds(seconds);
+
+    vector<vector<double>> vector_thread_latencies(connection_count);
+    vector<thread> vector_threads;
+    for (int i = 0; i < connection_count; i++) {
+        vector_threads.emplace_back(LoadHandle, port, std::cref(vector_image), time_end,
+                                    std::ref(vector_thread_latencies[i]));
+    }
+    for (auto& item : vector_threads) {
+        item.join();
+    }
+
+    vector<double> vector_latencies;
+    for (const auto& item : vector_thread_latencies) {
+        vector_latencies.insert(vector_latencies.end(), item.begin(), item.end());
+    }
+    std::sort(vector_latencies.begin(), vector_latencies.end());
+
+    cout << name << ": " << (double) vector_latencies.size() / seconds << " fps";
+    if (!vector_latencies.empty()) {
+        cout << ", p50 " << vector_latencies[vector_latencies.size() / 2]
+             << " us, p99 " << vector_latencies[vector_latencies.size() * 99 / 100] << " us";
+    }
+    cout << ", rss " << ReadStatusKb("VmRSS") << " kB, pages";
+    for (const auto& item : ReadNodePages()) {
+        cout << " N" << item.first << "=" << item.second;
+    }
+    cout << endl;
+
+    _exit(0);
+}
+
+
+/*!
+ * @brief compare floating threads with acceptor and connections pinned to NUMA nodes,
+ *        usage: benchmark-affinity [connections] [seconds] [acceptor_cpus]
+*/
+int main(int argc, char** argv) {
+    int connection_count = argc > 1 ? atoi(argv[1]) : 8;
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    string acceptor_cpus = argc > 3 ? argv[3] : "0";
+
+    // a synthetic 800x800 frame, the size our model consumes
+    cv::Mat mat_image(800, 800, CV_8UC3);
+    for (int row = 0; row < mat_image.rows; row++) {
+        for (int col = 0; col < mat_image.cols * 3; col++) {
+            mat_image.ptr(row)[col] = (uchar) ((row + col) / 4 + (row * col) % 7);
+        }
+    }
+
+    EncodeParams params;
+    params.quality = 90;
+    vector<uchar> vector_image;
+    ImageCodec::Encode(mat_image, params.format, params.ToImencodeParams(params.quality), vector_image);
+
+    auto vector_nodes = CpuTopology::GetNodeCpus();
+    cout << connection_count << " connections, " << seconds << " s per run, " << vector_nodes.size()
+         << " NUMA nodes" << endl;
+
+    ServerOptions options;
+    RunPlacement("floating", options, connection_count, seconds, vector_image);
+
+    options.acceptor_cpus = acceptor_cpus;
+    options.is_connection_numa_pinned = true;
+    RunPlacement("pinned  ", options, connection_count, seconds, vector_image);
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <sys/socket.h>
+#include "message.h"
+
+using namespace std;
+
+
+// the allocator of glibc, the functions below count their calls and forward to it
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* address, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+}
+
+// counters of the heap, only updated by a thread while its is_counting is set
+static thread_local bool is_counting = false;
+static atomic<long> allocation_count{0};
+static atomic<long> allocation_bytes{0};
+static atomic<long> large_allocation_count{0};
+
+// from this size on an allocation is frame-sized, e.g. an image or a message buffer
+static const size_t large_allocation_size = 4096;
+
+/*!
+ * @brief record one allocation of the calling thread
+ * @param[in] size bytes of the allocation
+*/
+static void CountAllocation(size_t size) {
+    if (!is_counting) {
+        return;
+    }
+
+    allocation_count++;
+    allocation_bytes += size;
+    if (size >= large_allocation_size) {
+        large_allocation_count++;
+    }
+}
+
+// every allocation of the process goes through these, operator new as well as cv::fastMalloc and tjAlloc
+extern "C" {
+    void* malloc(size_t size) {
+        CountAllocation(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        CountAllocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* address, size_t size) {
+        CountAllocation(size);
+        return __libc_realloc(address, size);
+    }
+
+    void* memalign(size_t alignment, size_t size) {
+        CountAllocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) {
+        CountAllocation(size);
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** address, size_t alignment, size_t size) {
+        CountAllocation(size);
+        *address = __libc_memalign(alignment, size);
+        return *address == nullptr ? ENOMEM : 0;
+    }
+}
+
+
+/*!
+ * @brief send one frame from client to server and back, the way Server::SocketHandle and Client::Start do
+ * @param[in] client_message Message of the client side
+ * @param[in] server_message Message of the server side
+ * @param[in] content_type "binary/mat", "binary/image" or "binary/image-batch"
+ * @param[in] vector_mat_request images of the request, the first one unless "binary/image-batch"
+ * @param[in,out] vector_mat_decoded images of the server, reused across frames
+ * @param[in,out] vector_mat_response images of the client, reused across frames
+ * @return true=succeed, false=failed
+*/
+static bool RunFrame(Message& client_message, Message& server_message, const string& content_type,
+                     const vector<cv::Mat>& vector_mat_request, vector<cv::Mat>& vector_mat_decoded,
+                     vector<cv::Mat>& vector_mat_response) {
+    unsigned char* item_buffer;
+    long item_length = 0;
+
+    bool is_raw = content_type == "binary/mat";
+    bool is_batch = content_type == "binary/image-batch";
+
+    client_message.Clear();
+    bool is_written = is_raw ? client_message.WriteMat(vector_mat_request[0]) :
+                      is_batch ? client_message.WriteImages(vector_mat_request) :
+                      client_message.WriteImage(vector_mat_request[0]);
+    if (!is_written) {
+        return false;
+    }
+
+    server_message.Clear();
+    if (!server_message.Read()) {
+        return false;
+    }
+
+    if (is_raw) {
+        vector_mat_decoded.resize(1);
+        if (!server_message.GetMatResult(vector_mat_decoded[0]) || !server_message.WriteMat(vector_mat_decoded[0])) {
+            return false;
+        }
+    } else {
+        vector_mat_decoded.resize(server_message.GetImageCount());
+        for (size_t i = 0; i < vector_mat_decoded.size(); i++) {
+            server_message.GetImageBufferResult(i, item_buffer, item_length);
+            ImageCodec::Decode(item_buffer, item_length, vector_mat_decoded[i]);
+        }
+
+        is_written = is_batch ? server_message.WriteImages(vector_mat_decoded) :
+                     !vector_mat_decoded.empty() && server_message.WriteImage(vector_mat_decoded[0]);
+        if (!is_written) {
+            return false;
+        }
+    }
+
+    if (!client_message.Read()) {
+        return false;
+    }
+
+    if (is_raw) {
+        vector_mat_response.resize(1);
+        return client_message.GetMatResult(vector_mat_response[0]);
+    }
+
+    vector_mat_response.resize(client_message.GetImageCount());
+    for (size_t i = 0; i < vector_mat_response.size(); i++) {
+        client_message.GetImageBufferResult(i, item_buffer, item_length);
+        if (!ImageCodec::Decode(item_buffer, item_length, vector_mat_response[i])) {
+            return false;
+        }
+    }
+    return !vector_mat_response.empty();
+}
+
+/*!
+ * @brief get the pixel buffers a frame decoded into
+ * @param[in] vector_mat_decoded images of the server
+ * @param[in] vector_mat_response images of the client
+ * @return data pointers, in order
+*/
+static vector<const uchar*> GetDataPointers(const vector<cv::Mat>& vector_mat_decoded,
+                                            const vector<cv::Mat>& vector_mat_response) {
+    vector<const uchar*> vector_data;
+    for (const auto& item : vector_mat_decoded) {
+        vector_data.push_back(item.data);
+    }
+    for (const auto& item : vector_mat_response) {
+        vector_data.push_back(item.data);
+    }
+    return vector_data;
+}
+
+/*!
+ * @brief warm up, then count the allocations of frames and check that every image stays in its buffer
+ * @param[in] content_type "binary/mat", "binary/image" or "binary/image-batch"
+ * @param[in] vector_mat_request images of the request
+ * @param[in] frames count of counted frames
+ * @param[out] is_moved true=an image was decoded into a new buffer in steady state
+ * @return count of frame-sized allocations, -1 means a frame failed
+*/
+static long RunCounted(const string& content_type, const vector<cv::Mat>& vector_mat_request, int frames,
+                       bool& is_moved) {
+    // both ends in this process, a frame fits into the socket buffers so one thread can drive both
+    int socket_fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socket_fds) == -1) {
+        perror("Error: socketpair");
+        return -1;
+    }
+
+    long result = -1;
+    is_moved = false;
+    {
+        Message client_message(socket_fds[0], "client");
+        Message server_message(socket_fds[1], "server");
+
+        vector<cv::Mat> vector_mat_decoded;
+        vector<cv::Mat> vector_mat_response;
+
+        // buffers grow to their steady size here
+        bool is_succeed = true;
+        for (int i = 0; i < 10 && is_succeed; i++) {
+            is_succeed = RunFrame(client_message, server_message, content_type, vector_mat_request,
+                                  vector_mat_decoded, vector_mat_response);
+        }
+        auto vector_data = GetDataPointers(vector_mat_decoded, vector_mat_response);
+
+        allocation_count = 0;
+        allocation_bytes = 0;
+        large_allocation_count = 0;
+
+        for (int i = 0; i < frames && is_succeed; i++) {
+            is_counting = true;
+            is_succeed = RunFrame(client_message, server_message, content_type, vector_mat_request,
+                                  vector_mat_decoded, vector_mat_response);
+            is_counting = false;
+
+            is_moved = is_moved || GetDataPointers(vector_mat_decoded, vector_mat_response) != vector_data;
+        }
+
+        if (is_succeed) {
+            cout << content_type << ": " << (double) allocation_count / frames << " allocations, "
+                 << (double) allocation_bytes / frames << " bytes, "
+                 << (double) large_allocation_count / frames << " allocations of " << large_allocation_size
+                 << " bytes or more per frame, images " << (is_moved ? "moved" : "stayed in their buffers") << endl;
+            result = large_allocation_count;
+        } else {
+            cout << content_type << ": frame failed" << endl;
+        }
+    }
+
+    close(socket_fds[0]);
+    close(socket_fds[1]);
+    return result;
+}
+
+
+/*!
+ * @brief count heap allocations of steady-state frames, usage: benchmark-alloc [frames]
+ * @return 0=no frame-sized allocation and no image moved in steady state, 1=otherwise
+*/
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 100;
+
+    // small enough that a whole "binary/mat" frame fits into the socket buffer
+    cv::Mat mat_image(120, 160, CV_8UC3);
+    for (int row = 0; row < mat_image.rows; row++) {
+        for (int col = 0; col < mat_image.cols * 3; col++) {
+            mat_image.ptr(row)[col] = (uchar) ((row + col) / 4 + (row * col) % 7);
+        }
+    }
+    vector<cv::Mat> vector_mat_request{mat_image, mat_image};
+
+    // cv::imencode and cv::imdecode allocate inside OpenCV, their counts are only held to zero with TurboJPEG
+    bool is_codec_checked = ImageCodec::GetBackend() == CodecBackend::TurboJpeg;
+
+    bool is_passed = true;
+    for (const char* content_type : {"binary/mat", "binary/image", "binary/image-batch"}) {
+        bool is_moved = false;
+        long count = RunCounted(content_type, vector_mat_request, frames, is_moved);
+
+        bool is_counted = string(content_type) == "binary/mat" || is_codec_checked;
+        is_passed = is_passed && count != -1 && !is_moved && (!is_counted || count == 0);
+    }
+
+    if (!is_codec_checked) {
+        cout << "binary/image allocations come from cv::imencode / cv::imdecode, build with -DUSE_TURBOJPEG=ON to check them" << endl;
+    }
+
+    return is_passed ? 0 : 1;
+}
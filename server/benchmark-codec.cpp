@@ -0,0 +1,80 @@
+#include <chrono>
+#include <iostream>
+#include "encode_params.h"
+#include "image_codec.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+/*!
+ * @brief encode and decode one image repeatedly with a backend and print the time per frame
+ * @param[in] backend codec backend
+ * @param[in] mat_image image to encode
+ * @param[in] iterations count of frames
+*/
+static void RunBackend(CodecBackend backend, const cv::Mat& mat_image, int iterations) {
+    ImageCodec::SetBackend(backend);
+
+    if (ImageCodec::GetBackend() != backend) {
+        cout << "TurboJPEG: not built, configure with -DUSE_TURBOJPEG=ON" << endl;
+        return;
+    }
+
+    EncodeParams params;
+    params.quality = 90;
+    auto imencode_params = params.ToImencodeParams(params.quality);
+
+    vector<uchar> vector_image;
+    cv::Mat mat_decoded;
+
+    // warm up handles and buffers
+    ImageCodec::Encode(mat_image, params.format, imencode_params, vector_image);
+    ImageCodec::Decode(vector_image.data(), vector_image.size(), mat_decoded);
+
+    auto time_begin = steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        ImageCodec::Encode(mat_image, params.format, imencode_params, vector_image);
+    }
+    auto encode_ms = duration_cast<microseconds>(steady_clock::now() - time_begin).count() / 1000.0 / iterations;
+
+    time_begin = steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        ImageCodec::Decode(vector_image.data(), vector_image.size(), mat_decoded);
+    }
+    auto decode_ms = duration_cast<microseconds>(steady_clock::now() - time_begin).count() / 1000.0 / iterations;
+
+    cout << (backend == CodecBackend::TurboJpeg ? "TurboJPEG" : "OpenCV   ")
+         << ": encode " << encode_ms << " ms, decode " << decode_ms << " ms, "
+         << vector_image.size() << " bytes per frame" << endl;
+}
+
+
+/*!
+ * @brief compare jpg backends, usage: benchmark-codec [image_path] [iterations]
+*/
+int main(int argc, char** argv) {
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+
+    cv::Mat mat_image;
+    if (argc > 1) {
+        mat_image = cv::imread(argv[1], cv::IMREAD_COLOR);
+    }
+
+    // a synthetic 800x800 frame, the size our model consumes
+    if (mat_image.empty()) {
+        mat_image.create(800, 800, CV_8UC3);
+        for (int row = 0; row < mat_image.rows; row++) {
+            for (int col = 0; col < mat_image.cols * 3; col++) {
+                mat_image.ptr(row)[col] = (uchar) ((row + col) / 4 + (row * col) % 7);
+            }
+        }
+    }
+
+    cout << "image " << mat_image.cols << "x" << mat_image.rows << ", " << iterations << " iterations" << endl;
+
+    RunBackend(CodecBackend::OpenCV, mat_image, iterations);
+    RunBackend(CodecBackend::TurboJpeg, mat_image, iterations);
+
+    return 0;
+}
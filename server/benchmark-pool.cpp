@@ -0,0 +1,145 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "server.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+/*!
+ * @brief connect to a server of this process, retrying while it starts
+ * @param[in] port port of the server
+ * @return socket fd, -1 means failed
+*/
+static int Connect(int port) {
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    for (int i = 0; i < 100; i++) {
+        int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(socket_fd, (struct sockaddr *)& server_addr, sizeof(server_addr)) == 0) {
+            return socket_fd;
+        }
+        close(socket_fd);
+        this_thread::sleep_for(milliseconds(50));
+    }
+    return -1;
+}
+
+/*!
+ * @brief send frames in lock-step until the time is up, the way Client::Start does
+ * @param[in] port port of the server
+ * @param[in] vector_image encoded image of every frame
+ * @param[in] time_end time to stop sending
+ * @param[out] frame_count count of answered frames
+*/
+static void LoadHandle(int port, const vector<uchar>& vector_image, steady_clock::time_point time_end,
+                       atomic<long>& frame_count) {
+    int socket_fd = Connect(port);
+    if (socket_fd == -1) {
+        LOG_ERROR("failed to connect to port " << port);
+        return;
+    }
+
+    {
+        Message message(socket_fd, "benchmark");
+        iovec image = {(void*) vector_image.data(), vector_image.size()};
+
+        while (steady_clock::now() < time_end) {
+            message.Clear();
+            if (!message.WriteEncodedImages(&image, 1, false) || !message.Read()) {
+                break;
+            }
+            frame_count++;
+        }
+    }
+
+    close(socket_fd);
+}
+
+/*!
+ * @brief start a server with a processing pool and measure the frames per second of the load
+ * @param[in] port port of the server, a new one per run
+ * @param[in] options options of the server
+ * @param[in] connection_count count of loading connections
+ * @param[in] seconds duration of the load
+ * @param[in] vector_image encoded image of every frame
+ * @return frames per second
+*/
+static double RunPool(int port, const ServerOptions& options, int connection_count, int seconds,
+                      const vector<uchar>& vector_image) {
+    auto server = new Server("127.0.0.1", port, 60, options);
+    thread thread_server(&Server::Start, server);
+
+    atomic<long> frame_count{0};
+    auto time_end = steady_clock::now() + std::chrono::seconds(seconds);
+
+    vector<thread> vector_threads;
+    for (int i = 0; i < connection_count; i++) {
+        vector_threads.emplace_back(LoadHandle, port, std::cref(vector_image), time_end, std::ref(frame_count));
+    }
+    for (auto& item : vector_threads) {
+        item.join();
+    }
+
+    // the loading connections are closed, Start() returns once it has joined them
+    server->Stop();
+    thread_server.join();
+    delete server;
+
+    return (double) frame_count / seconds;
+}
+
+
+/*!
+ * @brief compare the shared-queue scheduler and the work-stealing pool from 1 to max threads,
+ *        usage: benchmark-pool [max_threads] [connections] [seconds] [--numa]
+*/
+int main(int argc, char** argv) {
+    int max_thread_count = argc > 1 ? atoi(argv[1]) : 64;
+    int connection_count = argc > 2 ? atoi(argv[2]) : 2 * max_thread_count;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    bool is_numa_pinned = argc > 4 && strcmp(argv[4], "--numa") == 0;
+
+    // a synthetic 800x800 frame, the size our model consumes
+    cv::Mat mat_image(800, 800, CV_8UC3);
+    for (int row = 0; row < mat_image.rows; row++) {
+        for (int col = 0; col < mat_image.cols * 3; col++) {
+            mat_image.ptr(row)[col] = (uchar) ((row + col) / 4 + (row * col) % 7);
+        }
+    }
+
+    EncodeParams params;
+    params.quality = 90;
+    vector<uchar> vector_image;
+    ImageCodec::Encode(mat_image, params.format, params.ToImencodeParams(params.quality), vector_image);
+
+    cout << connection_count << " connections, " << seconds << " s per run"
+         << (is_numa_pinned ? ", NUMA pinned" : "") << endl;
+    cout << "threads  scheduler fps  work-stealing fps" << endl;
+
+    int port = 40000;
+    for (int thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+        ServerOptions options;
+        options.process_thread_count = thread_count;
+        options.is_numa_pinned = is_numa_pinned;
+
+        double scheduler_fps = RunPool(port++, options, connection_count, seconds, vector_image);
+
+        options.is_work_stealing = true;
+
+        double stealing_fps = RunPool(port++, options, connection_count, seconds, vector_image);
+
+        cout << thread_count << "\t " << scheduler_fps << "\t\t" << stealing_fps << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "server.h"
+
+using namespace std;
+using namespace std::chrono;
+
+
+/*!
+ * @brief connect to a server of this process with socket options, retrying while it starts
+ * @param[in] port port of the server
+ * @param[in] socket_options options of the client socket
+ * @return socket fd, -1 means failed
+*/
+static int Connect(int port, const SocketOptions& socket_options) {
+    struct sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    for (int i = 0; i < 100; i++) {
+        int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+        socket_options.Apply(socket_fd);
+
+        if (connect(socket_fd, (struct sockaddr *)& server_addr, sizeof(server_addr)) == 0) {
+            return socket_fd;
+        }
+        close(socket_fd);
+        this_thread::sleep_for(milliseconds(50));
+    }
+    return -1;
+}
+
+/*!
+ * @brief start a server with socket options on both ends and measure the round trips of lock-step frames
+ * @param[in] name name of the run
+ * @param[in] port port of the server, a new one per run as servers are never stopped
+ * @param[in] socket_options options of the server and the client sockets
+ * @param[in] frames count of frames
+ * @param[in] vector_image encoded image of every frame
+*/
+static void RunSocket(const string& name, int port, const SocketOptions& socket_options, int frames,
+                      const vector<uchar>& vector_image) {
+    ServerOptions options;
+    options.socket_options = socket_options;
+
+    // Server::Start never returns, the server outlives the run
+    auto server = new Server("127.0.0.1", port, 60, options);
+    thread(&Server::Start, server).detach();
+
+    int socket_fd = Connect(port, socket_options);
+    if (socket_fd == -1) {
+        LOG_ERROR("failed to connect to port " << port);
+        return;
+    }
+
+    vector<double> vector_latencies;
+    {
+        Message message(socket_fd, "benchmark");
+        message.SetQuickAck(socket_options.is_quick_ack);
+
+        iovec image = {(void*) vector_image.data(), vector_image.size()};
+
+        // the first frames open the congestion window
+        for (int i = -10; i < frames; i++) {
+            auto time_begin = steady_clock::now();
+
+            message.Clear();
+            if (!message.WriteEncodedImages(&image, 1, false) || !message.Read()) {
+                break;
+            }
+            if (i >= 0) {
+                vector_latencies.push_back(duration_cast<microseconds>(steady_clock::now() - time_begin).count());
+            }
+        }
+    }
+    close(socket_fd);
+
+    if (vector_latencies.empty()) {
+        cout << name << ": frame failed" << endl;
+        return;
+    }
+
+    std::sort(vector_latencies.begin(), vector_latencies.end());
+
+    cout << name << ": p50 " << vector_latencies[vector_latencies.size() / 2]
+         << " us, p99 " << vector_latencies[vector_latencies.size() * 99 / 100]
+         << " us, max " << vector_latencies.back() << " us" << endl;
+}
+
+
+/*!
+ * @brief compare the round trip of frames with each socket option added in turn,
+ *        usage: benchmark-socket [frames] [image_size]
+*/
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 2000;
+    int image_size = argc > 2 ? atoi(argv[2]) : 256;
+
+    // a small synthetic frame, its header and content are short writes Nagle would hold back
+    cv::Mat mat_image(image_size, image_size, CV_8UC3);
+    for (int row = 0; row < mat_image.rows; row++) {
+        for (int col = 0; col < mat_image.cols * 3; col++) {
+            mat_image.ptr(row)[col] = (uchar) ((row + col) / 4 + (row * col) % 7);
+        }
+    }
+
+    EncodeParams params;
+    params.quality = 90;
+    vector<uchar> vector_image;
+    ImageCodec::Encode(mat_image, params.format, params.ToImencodeParams(params.quality), vector_image);
+
+    cout << frames << " frames of " << vector_image.size() << " bytes over tcp loopback" << endl;
+
+    int port = 42000;
+
+    SocketOptions socket_options;
+    socket_options.is_no_delay = false;
+    RunSocket("kernel defaults       ", port++, socket_options, frames, vector_image);
+
+    socket_options.is_no_delay = true;
+    RunSocket("+ TCP_NODELAY         ", port++, socket_options, frames, vector_image);
+
+    socket_options.is_quick_ack = true;
+    RunSocket("+ TCP_QUICKACK        ", port++, socket_options, frames, vector_image);
+
+    socket_options.send_buffer_size = 4 * 1024 * 1024;
+    socket_options.receive_buffer_size = 4 * 1024 * 1024;
+    RunSocket("+ 4 MB socket buffers ", port++, socket_options, frames, vector_image);
+
+    socket_options.busy_poll_us = 50;
+    RunSocket("+ SO_BUSY_POLL 50 us  ", port++, socket_options, frames, vector_image);
+
+    return 0;
+}
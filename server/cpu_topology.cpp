@@ -0,0 +1,121 @@
+#include "cpu_topology.h"
+#include "logger.h"
+
+#include <fstream>
+#include <sched.h>
+#include <thread>
+
+/*!
+ * @brief get the cpus of each NUMA node
+ * @return online cpus of node 0, node 1, ..., one node with every cpu when the kernel shows no nodes
+*/
+vector<vector<int>> CpuTopology::GetNodeCpus() {
+    vector<vector<int>> vector_nodes;
+
+    auto vector_node_ids = CpuTopology::ParseCpuList(CpuTopology::ReadLine("/sys/devices/system/node/online"));
+    for (int node_id : vector_node_ids) {
+        auto vector_cpus = CpuTopology::ParseCpuList(
+                CpuTopology::ReadLine("/sys/devices/system/node/node" + to_string(node_id) + "/cpulist"));
+
+        // memory-only nodes have no cpus
+        if (!vector_cpus.empty()) {
+            vector_nodes.push_back(vector_cpus);
+        }
+    }
+
+    if (vector_nodes.empty()) {
+        vector<int> vector_cpus = CpuTopology::ParseCpuList(CpuTopology::ReadLine("/sys/devices/system/cpu/online"));
+        if (vector_cpus.empty()) {
+            for (unsigned int i = 0; i < std::max(thread::hardware_concurrency(), 1u); i++) {
+                vector_cpus.push_back(i);
+            }
+        }
+        vector_nodes.push_back(vector_cpus);
+    }
+
+    return vector_nodes;
+}
+
+/*!
+ * @brief restrict a thread to some cpus
+ * @param[in] thread_handle native handle of the thread
+ * @param[in] vector_cpus cpus the thread may run on
+ * @return true=succeed, false=failed
+*/
+bool CpuTopology::PinThread(pthread_t thread_handle, const vector<int>& vector_cpus) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    for (int cpu : vector_cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+
+    int error_code = pthread_setaffinity_np(thread_handle, sizeof(cpu_set), &cpu_set);
+    if (error_code != 0) {
+        LOG_WARNING("failed to pin thread, error: " << error_code);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief choose the cpu of one of many threads, threads take turns over the nodes and then over their cpus
+ * @param[in] vector_nodes cpus of each NUMA node, from GetNodeCpus()
+ * @param[in] index index of the thread
+ * @return cpu of the thread, on node index % count of nodes
+*/
+int CpuTopology::GetSpreadCpu(const vector<vector<int>>& vector_nodes, int index) {
+    int node_count = (int) vector_nodes.size();
+
+    const auto& vector_cpus = vector_nodes[index % node_count];
+    return vector_cpus[(index / node_count) % vector_cpus.size()];
+}
+
+/*!
+ * @brief parse a kernel cpu list
+ * @param[in] text list like "0-3,8,10-11"
+ * @return numbers of the list in order
+*/
+vector<int> CpuTopology::ParseCpuList(const string& text) {
+    vector<int> vector_numbers;
+
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == string::npos) {
+            end = text.size();
+        }
+
+        string range = text.substr(begin, end - begin);
+        size_t dash = range.find('-');
+
+        try {
+            int first = stoi(range);
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+
+            for (int i = first; i <= last; i++) {
+                vector_numbers.push_back(i);
+            }
+        } catch (const std::exception&) {
+            // an empty or broken range
+        }
+
+        begin = end + 1;
+    }
+
+    return vector_numbers;
+}
+
+/*!
+ * @brief read the first line of a file
+ * @param[in] file_path path of file
+ * @return first line, empty if the file does not exist
+*/
+string CpuTopology::ReadLine(const string& file_path) {
+    std::ifstream file(file_path);
+    string line;
+    std::getline(file, line);
+    return line;
+}
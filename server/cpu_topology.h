@@ -0,0 +1,28 @@
+#ifndef SERVER_CPU_TOPOLOGY_H
+#define SERVER_CPU_TOPOLOGY_H
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// NUMA nodes and their cpus from sysfs, and pinning of threads to them
+class CpuTopology {
+
+public:
+    static vector<vector<int>> GetNodeCpus();
+
+    static bool PinThread(pthread_t thread_handle, const vector<int>& vector_cpus);
+
+    static int GetSpreadCpu(const vector<vector<int>>& vector_nodes, int index);
+
+    static vector<int> ParseCpuList(const string& text);
+
+private:
+
+    static string ReadLine(const string& file_path);
+};
+
+#endif //SERVER_CPU_TOPOLOGY_H
@@ -0,0 +1,127 @@
+#ifndef SERVER_FRAME_PIPELINE_H
+#define SERVER_FRAME_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "stream_queue.h"
+
+using namespace std;
+
+
+// bounded queue between two stages of a pipeline, any thread pushes and pops, items leave in the order of
+// their sequence however the threads of the previous stage finish them
+template<typename T>
+class StageQueue {
+
+public:
+    /*!
+     * @brief init StageQueue
+     * @param[in] capacity most items held, an item may only run this far ahead of the next one to pop
+    */
+    explicit StageQueue(long capacity) : capacity_(std::max(capacity, 1L)) {
+    }
+
+    /*!
+     * @brief queue the item of a sequence, waits while it is too far ahead of the next one to pop
+     * @param[in] sequence 0, 1, 2 ... every sequence pushed exactly once
+     * @param[in,out] item item to queue, moved in
+    */
+    void Push(long sequence, T& item) {
+        std::unique_lock<std::mutex> lock(this->mutex_items_);
+        this->cv_popped_.wait(lock, [this, sequence] { return sequence < this->next_sequence_ + this->capacity_; });
+
+        this->map_items_.emplace(sequence, std::move(item));
+        lock.unlock();
+
+        this->cv_pushed_.notify_all();
+    }
+
+    /*!
+     * @brief wait for the next item in sequence
+     * @param[out] sequence sequence of the item
+     * @param[out] item next item
+     * @return true=got an item, false=closed and every item popped
+    */
+    bool Pop(long& sequence, T& item) {
+        std::unique_lock<std::mutex> lock(this->mutex_items_);
+        this->cv_pushed_.wait(lock, [this] {
+            return this->is_closed_ || this->map_items_.count(this->next_sequence_) > 0;
+        });
+
+        auto iter = this->map_items_.find(this->next_sequence_);
+        if (iter == this->map_items_.end()) {
+            return false;
+        }
+
+        sequence = iter->first;
+        item = std::move(iter->second);
+        this->map_items_.erase(iter);
+        this->next_sequence_++;
+        lock.unlock();
+
+        this->cv_popped_.notify_all();
+        return true;
+    }
+
+    /*!
+     * @brief no more items come, Pop() returns false once the queued ones are gone
+    */
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_items_);
+            this->is_closed_ = true;
+        }
+        this->cv_pushed_.notify_all();
+    }
+
+private:
+    long capacity_;
+
+    // items by sequence, the next one may not have arrived yet
+    map<long, T> map_items_;
+
+    long next_sequence_ = 0;
+
+    bool is_closed_ = false;
+
+    mutex mutex_items_;
+
+    condition_variable cv_pushed_;
+
+    condition_variable cv_popped_;
+};
+
+// a frame passing the decode, process and encode stages
+struct StagedFrame {
+    StreamFrame frame;
+
+    vector<cv::Mat> vector_mat_image;
+
+    // vector_mat_image encoded by the encode stage
+    vector<vector<unsigned char>> vector_encoded;
+};
+
+// stages of one connection, frames are numbered as they leave its StreamQueue and keep that order across stages
+struct FramePipeline {
+    explicit FramePipeline(long queue_length) : queue_decoded(queue_length), queue_processed(queue_length) {
+    }
+
+    // decoding threads take frames from the StreamQueue one at a time, so numbers follow the queue's order
+    mutex mutex_pop;
+
+    long next_sequence = 0;
+
+    // decoding threads still running, the last one closes queue_decoded
+    atomic<int> decode_thread_count{0};
+
+    StageQueue<StagedFrame> queue_decoded;
+
+    StageQueue<StagedFrame> queue_processed;
+};
+
+#endif //SERVER_FRAME_PIPELINE_H
@@ -0,0 +1,124 @@
+#include "frame_scheduler.h"
+#include "cpu_topology.h"
+
+#include <algorithm>
+
+/*!
+ * @brief init FrameScheduler and start its threads
+ * @param[in] thread_count count of processing threads
+ * @param[in] map_weights weight of each priority class, a class without a weight gets 1
+ * @param[in] is_numa_pinned true=pin each thread to one cpu, spread over the NUMA nodes
+*/
+FrameScheduler::FrameScheduler(int thread_count, const map<PriorityClass, int>& map_weights, bool is_numa_pinned) {
+    this->map_weights_ = map_weights;
+
+    auto vector_nodes = is_numa_pinned ? CpuTopology::GetNodeCpus() : vector<vector<int>>();
+
+    for (int i = 0; i < std::max(thread_count, 1); i++) {
+        this->vector_threads_.emplace_back(&FrameScheduler::WorkHandle, this);
+
+        if (is_numa_pinned) {
+            CpuTopology::PinThread(this->vector_threads_[i].native_handle(),
+                                   {CpuTopology::GetSpreadCpu(vector_nodes, i)});
+        }
+    }
+}
+
+/*!
+ * @brief stop the threads, jobs still queued are not run
+*/
+FrameScheduler::~FrameScheduler() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_tasks_);
+        this->is_stopped_ = true;
+    }
+    this->cv_queued_.notify_all();
+    this->cv_done_.notify_all();
+
+    for (auto& item : this->vector_threads_) {
+        item.join();
+    }
+}
+
+/*!
+ * @brief run a job on the pool and wait for it, jobs of busier or lower classes wait longer
+ * @param[in] flow connection and stream of the frame
+ * @param[in] priority class of the stream
+ * @param[in] cost work of the job, e.g. count of images
+ * @param[in] job processing of the frame
+*/
+void FrameScheduler::Run(const FlowKey& flow, PriorityClass priority, long cost, const function<void()>& job) {
+    auto iter_weight = this->map_weights_.find(priority);
+    int weight = iter_weight == this->map_weights_.end() ? 1 : std::max(iter_weight->second, 1);
+
+    bool is_done = false;
+
+    std::unique_lock<std::mutex> lock(this->mutex_tasks_);
+
+    // the flow's tasks queue behind each other, an idle flow starts at the current virtual time
+    auto iter_flow = this->map_flow_finish_.find(flow);
+    double start_tag = iter_flow == this->map_flow_finish_.end() ?
+                       this->virtual_time_ : std::max(this->virtual_time_, iter_flow->second);
+    double finish_tag = start_tag + (double) std::max(cost, 1L) / weight;
+
+    this->map_flow_finish_[flow] = finish_tag;
+    this->queue_tasks_.push({finish_tag, this->next_sequence_++, flow, &job, &is_done});
+    this->cv_queued_.notify_one();
+
+    this->cv_done_.wait(lock, [this, &is_done] { return is_done || this->is_stopped_; });
+}
+
+/*!
+ * @brief parse the "priority" of a frame header
+ * @param[in] text "critical", "normal" or "bulk"
+ * @param[out] priority priority class
+ * @return true=known class
+*/
+bool FrameScheduler::ParsePriority(const string& text, PriorityClass& priority) {
+    if (text == "critical") {
+        priority = PriorityClass::Critical;
+    } else if (text == "normal") {
+        priority = PriorityClass::Normal;
+    } else if (text == "bulk") {
+        priority = PriorityClass::Bulk;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief processing thread, runs the task with the smallest finish tag
+*/
+void FrameScheduler::WorkHandle() {
+    while (true) {
+        Task task{};
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_tasks_);
+            this->cv_queued_.wait(lock, [this] { return this->is_stopped_ || !this->queue_tasks_.empty(); });
+
+            if (this->is_stopped_) {
+                return;
+            }
+
+            task = this->queue_tasks_.top();
+            this->queue_tasks_.pop();
+
+            this->virtual_time_ = std::max(this->virtual_time_, task.finish_tag);
+
+            // the last task of the flow, the next one starts from the virtual time again
+            auto iter_flow = this->map_flow_finish_.find(task.flow);
+            if (iter_flow != this->map_flow_finish_.end() && iter_flow->second <= task.finish_tag) {
+                this->map_flow_finish_.erase(iter_flow);
+            }
+        }
+
+        (*task.job)();
+
+        {
+            std::lock_guard<std::mutex> lockGuard(this->mutex_tasks_);
+            *task.is_done = true;
+        }
+        this->cv_done_.notify_all();
+    }
+}
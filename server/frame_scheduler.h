@@ -0,0 +1,86 @@
+#ifndef SERVER_FRAME_SCHEDULER_H
+#define SERVER_FRAME_SCHEDULER_H
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// priority class of a stream, each class gets its weight's share of the processing threads when all are busy
+enum class PriorityClass : int {
+    // latency-critical live streams
+    Critical = 0,
+    Normal = 1,
+    // backfill traffic using leftover capacity
+    Bulk = 2
+};
+
+
+// runs the processing of frames from every connection on a pool of threads, in weighted fair queuing order:
+// each flow (a stream of a connection) is served in proportion to the weight of its class
+class FrameScheduler {
+
+public:
+    // connection and stream of a frame
+    using FlowKey = pair<long, long>;
+
+    FrameScheduler(int thread_count, const map<PriorityClass, int>& map_weights, bool is_numa_pinned = false);
+
+    ~FrameScheduler();
+
+    void Run(const FlowKey& flow, PriorityClass priority, long cost, const function<void()>& job);
+
+    static bool ParsePriority(const string& text, PriorityClass& priority);
+
+private:
+
+    struct Task {
+        // virtual finish time, the smallest one runs first
+        double finish_tag;
+        // order of submission, breaks ties
+        unsigned long sequence;
+        FlowKey flow;
+        const function<void()>* job;
+        // set when the job has run, under mutex_tasks_
+        bool* is_done;
+    };
+
+    struct TaskLater {
+        bool operator()(const Task& a, const Task& b) const {
+            return a.finish_tag != b.finish_tag ? a.finish_tag > b.finish_tag : a.sequence > b.sequence;
+        }
+    };
+
+    map<PriorityClass, int> map_weights_;
+
+    priority_queue<Task, vector<Task>, TaskLater> queue_tasks_;
+
+    // finish tag of the last queued task of each flow with tasks waiting
+    map<FlowKey, double> map_flow_finish_;
+
+    // finish tag of the last task started, a new flow starts from here
+    double virtual_time_ = 0;
+
+    unsigned long next_sequence_ = 0;
+
+    bool is_stopped_ = false;
+
+    mutex mutex_tasks_;
+
+    condition_variable cv_queued_;
+
+    condition_variable cv_done_;
+
+    vector<thread> vector_threads_;
+
+    void WorkHandle();
+};
+
+#endif //SERVER_FRAME_SCHEDULER_H
@@ -0,0 +1,82 @@
+#ifndef SERVER_IMAGE_CODEC_H
+#define SERVER_IMAGE_CODEC_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#ifdef USE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+using namespace std;
+
+enum class CodecBackend : int {
+    OpenCV = 0,
+    // jpg only, other formats always go through OpenCV
+    TurboJpeg = 1
+};
+
+// decode only the pixels the pipeline consumes, jpg is scaled in the DCT domain while decoding
+struct DecodeOptions {
+    // decode at 1 / scale_denom of the size, 1, 2, 4 or 8
+    int scale_denom = 1;
+
+    // smallest size the caller resizes to, when set the largest scale_denom that keeps it is chosen
+    cv::Size target_size;
+
+    // region in source pixels, empty means the whole image
+    cv::Rect roi;
+};
+
+
+// encode and decode images, jpg goes through TurboJPEG with per-thread handles when built with USE_TURBOJPEG
+class ImageCodec {
+
+public:
+    static void SetBackend(CodecBackend backend);
+
+    static CodecBackend GetBackend();
+
+    static bool Encode(const cv::Mat& mat_image, const string& format, const vector<int>& imencode_params,
+                       vector<uchar>& output);
+
+    static bool Decode(const unsigned char* data, long length, cv::Mat& output);
+
+    static bool Decode(const unsigned char* data, long length, const DecodeOptions& options, cv::Mat& output);
+
+    static bool Read(const string& file_path, const DecodeOptions& options, cv::Mat& output);
+
+    static bool ReadFile(const string& file_path, vector<unsigned char>& output);
+
+    static bool GetJpegSize(const unsigned char* data, long length, int& width, int& height);
+
+    static int GetScaleDenominator(const cv::Size& source_size, const cv::Size& target_size);
+
+private:
+
+    static atomic<int> backend_;
+
+    static bool IsJpeg(const unsigned char* data, long length);
+
+    static bool DecodeScaled(const unsigned char* data, long length, int scale_denom, cv::Mat& output);
+
+#ifdef USE_TURBOJPEG
+    // handles of one thread, kept warm across frames
+    struct TurboContext {
+        tjhandle compressor = nullptr;
+        tjhandle decompressor = nullptr;
+
+        ~TurboContext();
+    };
+
+    static TurboContext& GetTurboContext();
+
+    static bool TurboEncode(const cv::Mat& mat_image, const vector<int>& imencode_params, vector<uchar>& output);
+
+    static bool TurboDecode(const unsigned char* data, long length, int scale_denom, cv::Mat& output);
+#endif
+};
+
+#endif //SERVER_IMAGE_CODEC_H
@@ -0,0 +1,228 @@
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+/*!
+ * @brief get the process wide logger, the flusher thread starts on first use
+ * @return Logger instance
+*/
+Logger& Logger::Instance() {
+    static Logger logger;
+    return logger;
+}
+
+/*!
+ * @brief init Logger Class and start the background flusher
+*/
+Logger::Logger() {
+#ifdef NDEBUG
+    this->level_ = (int) LogLevel::Info;
+#else
+    this->level_ = (int) LogLevel::Debug;
+#endif
+
+    this->thread_flusher_ = thread(&Logger::FlushHandle, this);
+}
+
+/*!
+ * @brief stop the flusher and write out every pending record
+*/
+Logger::~Logger() {
+    this->is_running_ = false;
+
+    if (this->thread_flusher_.joinable()) {
+        this->thread_flusher_.join();
+    }
+
+    this->Flush();
+}
+
+/*!
+ * @brief set the minimum level of records to keep
+ * @param[in] level minimum level
+*/
+void Logger::SetLevel(LogLevel level) {
+    this->level_ = (int) level;
+}
+
+/*!
+ * @brief check the level before formatting a record
+ * @param[in] level level of the record
+ * @return true=the record will be written
+*/
+bool Logger::IsEnabled(LogLevel level) const {
+    return (int) level >= this->level_.load(std::memory_order_relaxed);
+}
+
+/*!
+ * @brief push a record into the ring of calling thread, never blocks, drops the record if the ring is full
+ * @param[in] level level of the record
+ * @param[in] text text of the record, truncated to max_record_length_
+*/
+void Logger::Write(LogLevel level, const string& text) {
+    if (!this->GetThreadRing().Push(level, Logger::GetCurrentTimestamp(), text)) {
+        this->dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/*!
+ * @brief drain every ring and write the records to stdout in timestamp order
+*/
+void Logger::Flush() {
+    std::lock_guard<std::mutex> lockGuardFlush(this->mutex_flush_);
+
+    vector<shared_ptr<RingBuffer>> vector_rings;
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_rings_);
+        vector_rings = this->vector_rings_;
+    }
+
+    vector<LogRecord> vector_records;
+    LogRecord record{};
+
+    for (auto& ring : vector_rings) {
+        while (ring->Pop(record)) {
+            vector_records.push_back(record);
+        }
+    }
+
+    if (!vector_records.empty()) {
+        std::stable_sort(vector_records.begin(), vector_records.end(),
+                         [](const LogRecord& a, const LogRecord& b) { return a.timestamp_us < b.timestamp_us; });
+
+        string output;
+        for (const auto& item : vector_records) {
+            FormatRecord(item, output);
+        }
+
+        fwrite(output.data(), 1, output.size(), stdout);
+        fflush(stdout);
+    }
+
+    // release rings of exited threads, the flusher holds the last reference after the thread_local is destroyed
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_rings_);
+        this->vector_rings_.erase(
+                remove_if(this->vector_rings_.begin(), this->vector_rings_.end(),
+                          [](const shared_ptr<RingBuffer>& ring) { return ring.use_count() == 1 && ring->IsEmpty(); }),
+                this->vector_rings_.end());
+    }
+}
+
+/*!
+ * @brief get the count of records dropped because a ring was full
+ * @return count of dropped records
+*/
+long Logger::GetDroppedCount() const {
+    return this->dropped_count_.load();
+}
+
+/*!
+ * @brief get the ring of calling thread, register it on first use
+ * @return ring of calling thread
+*/
+Logger::RingBuffer& Logger::GetThreadRing() {
+    static thread_local shared_ptr<RingBuffer> thread_ring;
+
+    if (!thread_ring) {
+        thread_ring = make_shared<RingBuffer>();
+
+        std::lock_guard<std::mutex> lockGuard(this->mutex_rings_);
+        this->vector_rings_.push_back(thread_ring);
+    }
+
+    return *thread_ring;
+}
+
+/*!
+ * @brief flusher thread, drains rings every flush_interval_ms_
+*/
+void Logger::FlushHandle() {
+    while (this->is_running_) {
+        this->Flush();
+
+        usleep(Logger::flush_interval_ms_ * 1000);
+    }
+}
+
+/*!
+ * @brief append "[time] [LEVEL] text\n" to output
+ * @param[in] record log record
+ * @param[out] output text buffer
+*/
+void Logger::FormatRecord(const LogRecord& record, string& output) {
+    static const char* level_names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+    time_t seconds = record.timestamp_us / 1000000;
+    struct tm tm_time{};
+    localtime_r(&seconds, &tm_time);
+
+    char prefix[64];
+    auto prefix_length = strftime(prefix, sizeof(prefix), "[%Y-%m-%d %H:%M:%S", &tm_time);
+    prefix_length += snprintf(&prefix[prefix_length], sizeof(prefix) - prefix_length, ".%03ld] [%s] ",
+                              (record.timestamp_us / 1000) % 1000, level_names[(int) record.level]);
+
+    output.append(prefix, prefix_length);
+    output.append(record.text, record.length);
+    output.push_back('\n');
+}
+
+/*!
+ * @brief get current time in micro seconds
+ * @return micro seconds since epoch
+*/
+long Logger::GetCurrentTimestamp() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/*!
+ * @brief copy a record into the ring, called by the owner thread only
+ * @return true=succeed, false=ring is full
+*/
+bool Logger::RingBuffer::Push(LogLevel level, long timestamp_us, const string& text) {
+    auto head = this->head_.load(std::memory_order_relaxed);
+
+    if (head - this->tail_.load(std::memory_order_acquire) >= Logger::ring_capacity_) {
+        return false;
+    }
+
+    auto& record = this->records_[head % Logger::ring_capacity_];
+    record.level = level;
+    record.timestamp_us = timestamp_us;
+    record.length = (unsigned short) std::min<size_t>(text.size(), Logger::max_record_length_);
+    memcpy(record.text, text.data(), record.length);
+
+    this->head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/*!
+ * @brief take the oldest record from the ring, called by the flusher only
+ * @return true=got a record, false=ring is empty
+*/
+bool Logger::RingBuffer::Pop(LogRecord& record) {
+    auto tail = this->tail_.load(std::memory_order_relaxed);
+
+    if (tail == this->head_.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    record = this->records_[tail % Logger::ring_capacity_];
+
+    this->tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+/*!
+ * @brief check whether the ring has pending records
+ * @return true=empty
+*/
+bool Logger::RingBuffer::IsEmpty() const {
+    return this->tail_.load(std::memory_order_acquire) == this->head_.load(std::memory_order_acquire);
+}
@@ -0,0 +1,136 @@
+#ifndef SERVER_LOGGER_H
+#define SERVER_LOGGER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// severity of a log record, records below Logger's level are dropped before formatting
+enum class LogLevel : int {
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+    Off = 4
+};
+
+
+class Logger {
+
+public:
+    static Logger& Instance();
+
+    ~Logger();
+
+    void SetLevel(LogLevel level);
+
+    bool IsEnabled(LogLevel level) const;
+
+    void Write(LogLevel level, const string& text);
+
+    void Flush();
+
+    long GetDroppedCount() const;
+
+private:
+
+    static const int max_record_length_ = 240;
+
+    static const int ring_capacity_ = 1024;
+
+    static const int flush_interval_ms_ = 5;
+
+    struct LogRecord {
+        LogLevel level;
+        long timestamp_us;
+        unsigned short length;
+        char text[max_record_length_];
+    };
+
+    // single-producer single-consumer ring, the producer is the owner thread and the consumer is the flusher
+    class RingBuffer {
+    public:
+        bool Push(LogLevel level, long timestamp_us, const string& text);
+
+        bool Pop(LogRecord& record);
+
+        bool IsEmpty() const;
+
+    private:
+        LogRecord records_[ring_capacity_]{};
+
+        atomic<unsigned long> head_{0};
+
+        atomic<unsigned long> tail_{0};
+    };
+
+    Logger();
+
+    atomic<int> level_;
+
+    atomic<bool> is_running_{true};
+
+    atomic<long> dropped_count_{0};
+
+    // every thread which has written a record owns one ring here
+    vector<shared_ptr<RingBuffer>> vector_rings_;
+
+    mutex mutex_rings_;
+
+    // serialize Flush() calls from the flusher and from other threads
+    mutex mutex_flush_;
+
+    thread thread_flusher_;
+
+    RingBuffer& GetThreadRing();
+
+    void FlushHandle();
+
+    static void FormatRecord(const LogRecord& record, string& output);
+
+    static long GetCurrentTimestamp();
+};
+
+
+#define LOG_AT(level, expr) \
+    do { \
+        if (Logger::Instance().IsEnabled(level)) { \
+            std::ostringstream log_stream_; \
+            log_stream_ << expr; \
+            Logger::Instance().Write(level, log_stream_.str()); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(expr) LOG_AT(LogLevel::Debug, expr)
+#define LOG_INFO(expr) LOG_AT(LogLevel::Info, expr)
+#define LOG_WARNING(expr) LOG_AT(LogLevel::Warning, expr)
+#define LOG_ERROR(expr) LOG_AT(LogLevel::Error, expr)
+
+// per-frame records: every record in debug builds, compiled out in release builds unless a sample rate is given
+#ifndef LOG_FRAME_SAMPLE_RATE
+#ifdef NDEBUG
+#define LOG_FRAME_SAMPLE_RATE 0
+#else
+#define LOG_FRAME_SAMPLE_RATE 1
+#endif
+#endif
+
+#if LOG_FRAME_SAMPLE_RATE > 0
+#define LOG_FRAME(expr) \
+    do { \
+        static thread_local unsigned long log_frame_counter_ = 0; \
+        if (log_frame_counter_++ % LOG_FRAME_SAMPLE_RATE == 0) { \
+            LOG_AT(LogLevel::Debug, expr); \
+        } \
+    } while (0)
+#else
+#define LOG_FRAME(expr) do {} while (0)
+#endif
+
+#endif //SERVER_LOGGER_H
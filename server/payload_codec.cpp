@@ -0,0 +1,180 @@
+#include "payload_codec.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <climits>
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+
+namespace {
+    // contexts of one thread, kept warm across messages instead of allocating the tables per call
+    struct ZstdContext {
+        ZSTD_CCtx* compress_context = ZSTD_createCCtx();
+        ZSTD_DCtx* decompress_context = ZSTD_createDCtx();
+
+        ~ZstdContext() {
+            ZSTD_freeCCtx(this->compress_context);
+            ZSTD_freeDCtx(this->decompress_context);
+        }
+    };
+
+    ZstdContext& GetZstdContext() {
+        thread_local ZstdContext zstd_context;
+        return zstd_context;
+    }
+}
+#endif
+
+/*!
+ * @brief check whether this build compresses and decompresses an encoding
+ * @param[in] encoding "content-encoding", e.g. "lz4"
+ * @return true=supported
+*/
+bool PayloadCodec::IsSupported(const string& encoding) {
+    if (encoding == "binary") {
+        return true;
+    }
+#ifdef USE_LZ4
+    if (encoding == "lz4") {
+        return true;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (encoding == "zstd") {
+        return true;
+    }
+#endif
+    return false;
+}
+
+/*!
+ * @brief get the compressions of this build
+ * @return encodings, without "binary"
+*/
+vector<string> PayloadCodec::GetSupported() {
+    vector<string> vector_encodings;
+#ifdef USE_ZSTD
+    vector_encodings.emplace_back("zstd");
+#endif
+#ifdef USE_LZ4
+    vector_encodings.emplace_back("lz4");
+#endif
+    return vector_encodings;
+}
+
+/*!
+ * @brief get the largest output Compress() may write for an input
+ * @param[in] encoding "content-encoding"
+ * @param[in] length length of the input
+ * @return size of the output buffer, 0 if the encoding is not supported
+*/
+long PayloadCodec::GetCompressBound(const string& encoding, long length) {
+#ifdef USE_LZ4
+    if (encoding == "lz4") {
+        return length > LZ4_MAX_INPUT_SIZE ? 0 : LZ4_compressBound((int) length);
+    }
+#endif
+#ifdef USE_ZSTD
+    if (encoding == "zstd") {
+        return (long) ZSTD_compressBound(length);
+    }
+#endif
+#if !defined(USE_LZ4) && !defined(USE_ZSTD)
+    (void) encoding;
+    (void) length;
+#endif
+    return 0;
+}
+
+/*!
+ * @brief compress input into output
+ * @param[in] encoding "lz4" or "zstd"
+ * @param[in] level compression level, 0 = the library default, lz4 switches to its HC mode above 0
+ * @param[in] input content
+ * @param[in] length length of input
+ * @param[out] output compressed content
+ * @param[in] output_capacity size of output, at least GetCompressBound()
+ * @return length of the compressed content, 0 = failed
+*/
+long PayloadCodec::Compress(const string& encoding, int level, const unsigned char* input, long length,
+                            unsigned char* output, long output_capacity) {
+#ifdef USE_LZ4
+    if (encoding == "lz4" && length <= LZ4_MAX_INPUT_SIZE) {
+        auto source = (const char *) input;
+        auto destination = (char *) output;
+        int capacity = (int) std::min<long>(output_capacity, INT_MAX);
+
+        int compressed_length = level > 0 ?
+                                LZ4_compress_HC(source, destination, (int) length, capacity, level) :
+                                LZ4_compress_fast(source, destination, (int) length, capacity, std::max(-level, 1));
+        return compressed_length;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (encoding == "zstd") {
+        size_t compressed_length = ZSTD_compressCCtx(GetZstdContext().compress_context, output, output_capacity,
+                                                     input, length, level);
+        if (ZSTD_isError(compressed_length)) {
+            LOG_WARNING("zstd compression failed, " << ZSTD_getErrorName(compressed_length));
+            return 0;
+        }
+        return (long) compressed_length;
+    }
+#endif
+#if !defined(USE_LZ4) && !defined(USE_ZSTD)
+    (void) encoding;
+    (void) level;
+    (void) input;
+    (void) length;
+    (void) output;
+    (void) output_capacity;
+#endif
+    return 0;
+}
+
+/*!
+ * @brief decompress input into output
+ * @param[in] encoding "lz4" or "zstd"
+ * @param[in] input compressed content
+ * @param[in] length length of input
+ * @param[out] output content
+ * @param[in] original_length length of the content, "original-length" in the json header
+ * @return true=succeed, false=failed or the content is not original_length bytes
+*/
+bool PayloadCodec::Decompress(const string& encoding, const unsigned char* input, long length,
+                              unsigned char* output, long original_length) {
+#ifdef USE_LZ4
+    if (encoding == "lz4") {
+        if (length > INT_MAX || original_length > INT_MAX) {
+            return false;
+        }
+        return LZ4_decompress_safe((const char *) input, (char *) output, (int) length, (int) original_length) ==
+               original_length;
+    }
+#endif
+#ifdef USE_ZSTD
+    if (encoding == "zstd") {
+        size_t decompressed_length = ZSTD_decompressDCtx(GetZstdContext().decompress_context, output, original_length,
+                                                         input, length);
+        if (ZSTD_isError(decompressed_length)) {
+            LOG_WARNING("zstd decompression failed, " << ZSTD_getErrorName(decompressed_length));
+            return false;
+        }
+        return (long) decompressed_length == original_length;
+    }
+#endif
+#if !defined(USE_LZ4) && !defined(USE_ZSTD)
+    (void) encoding;
+    (void) input;
+    (void) length;
+    (void) output;
+    (void) original_length;
+#endif
+    return false;
+}
@@ -0,0 +1,28 @@
+#ifndef SERVER_PAYLOAD_CODEC_H
+#define SERVER_PAYLOAD_CODEC_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+// compress the content of "text/json" and "binary/tensor" messages, its "content-encoding" names the codec,
+// "lz4" is built with USE_LZ4 and "zstd" with USE_ZSTD, "binary" is the content as it is
+class PayloadCodec {
+
+public:
+    static bool IsSupported(const string& encoding);
+
+    static vector<string> GetSupported();
+
+    static long GetCompressBound(const string& encoding, long length);
+
+    static long Compress(const string& encoding, int level, const unsigned char* input, long length,
+                         unsigned char* output, long output_capacity);
+
+    static bool Decompress(const string& encoding, const unsigned char* input, long length,
+                           unsigned char* output, long original_length);
+};
+
+#endif //SERVER_PAYLOAD_CODEC_H
@@ -1,48 +1,112 @@
 #include "server.h"
 
+#include <poll.h>
+
 std::mutex mutex_ticks_map;
 
 
 /*!
  * @brief init server
- * @param[in] host
- * @param[in] port
+ * @param[in] host ip address, or "unix:/path/to.sock" and "unix:@name" for a unix socket
+ * @param[in] port ignored for a unix socket
  * @param[in] timeout in seconds
+ * @param[in] options decoding of requests, streams and scheduling of their processing
 */
-Server::Server(const string& host, int port, int timeout) {
-    this->host_ = host.c_str();
+Server::Server(const string& host, int port, int timeout, const ServerOptions& options) {
+    this->host_ = host;
     this->port_ = port;
     this->timeout_seconds_ = timeout;
+    this->options_ = options;
+
+    // one pool serves every connection, in the order of the streams' priority classes, or stealing work
+    if (this->options_.process_thread_count > 0 && this->options_.is_work_stealing) {
+        this->work_stealing_pool_.reset(new WorkStealingPool(this->options_.process_thread_count,
+                                                             this->options_.is_numa_pinned));
+    } else if (this->options_.process_thread_count > 0) {
+        this->frame_scheduler_.reset(new FrameScheduler(this->options_.process_thread_count,
+                                                        this->options_.map_priority_weights,
+                                                        this->options_.is_numa_pinned));
+    }
+
+    if (!this->options_.acceptor_cpus.empty() || this->options_.is_connection_numa_pinned) {
+        this->vector_node_cpus_ = CpuTopology::GetNodeCpus();
+    }
+
+    // unix sockets stay on the host and are not encrypted
+    if (this->options_.tls_options.is_enabled && !SocketAddress::IsUnix(this->host_)) {
+        this->tls_context_ = TlsContext::Create(this->options_.tls_options, true);
+    }
 
     // create the timeout daemon thread
     this->thread_timeout_daemon_ = thread(&Server::TimeoutHandle, this);
 }
 
 /*!
- * @brief start server
+ * @brief stop the server and wait for its threads
 */
-[[noreturn]] void Server::Start() {
+Server::~Server() {
+    this->Stop();
+
+    // Start() joins the daemon, unless it never ran
+    if (this->thread_timeout_daemon_.joinable()) {
+        this->thread_timeout_daemon_.join();
+    }
+}
+
+/*!
+ * @brief start server, returns after Stop() once every connection is closed
+*/
+void Server::Start() {
+
+    // the accepting thread and the timeout daemon stay off the cpus the connections work on
+    if (!this->options_.acceptor_cpus.empty()) {
+        auto vector_cpus = CpuTopology::ParseCpuList(this->options_.acceptor_cpus);
+
+        CpuTopology::PinThread(pthread_self(), vector_cpus);
+        CpuTopology::PinThread(this->thread_timeout_daemon_.native_handle(), vector_cpus);
+        LOG_INFO("accepting on cpus " << this->options_.acceptor_cpus);
+    }
 
-    int socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    bool is_unix = SocketAddress::IsUnix(this->host_);
+
+    int socket_fd = socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
 
     if (socket_fd == -1) {
         perror("Error: socket");
     }
 
-    auto opt = 1;
-    auto error_code = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    if (error_code == -1) {
-        perror("Error: setsockopt");
-    }
+    // accepted sockets take the buffer sizes of the listening socket while connecting
+    this->options_.socket_options.Apply(socket_fd);
+
+    if (is_unix) {
+        // bind
+        struct sockaddr_un server_addr{};
+        socklen_t server_addr_len = SocketAddress::MakeUnix(this->host_, server_addr);
+
+        // remove the socket file left by a previous run
+        if (!SocketAddress::IsAbstract(this->host_)) {
+            unlink(server_addr.sun_path);
+        }
+
+        if (server_addr_len == 0 || bind(socket_fd, (struct sockaddr *)& server_addr, server_addr_len) == -1) {
+            perror("Error: bind");
+        }
+    } else {
+        auto opt = 1;
+        auto error_code = setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (error_code == -1) {
+            perror("Error: setsockopt");
+        }
 
-    // bind
-    struct sockaddr_in server_addr{};
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(this->port_);
-    server_addr.sin_addr.s_addr = inet_addr(this->host_);
+        // bind
+        struct sockaddr_in server_addr{};
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(this->port_);
+        server_addr.sin_addr.s_addr = inet_addr(this->host_.c_str());
 
-    if (bind(socket_fd, (struct sockaddr *)& server_addr, sizeof(server_addr)) == -1) {
-        perror("Error: bind");
+        if (bind(socket_fd, (struct sockaddr *)& server_addr, sizeof(server_addr)) == -1) {
+            perror("Error: bind");
+        }
     }
 
     // listen
@@ -50,23 +114,36 @@ Server::Server(const string& host, int port, int timeout) {
         perror("Error: listen");
     }
 
-    while (true) {
+    // Stop() shuts the socket down to wake accept(), or Start() sees is_stopped_ if it stopped before
+    this->listen_fd_ = socket_fd;
+
+    while (!this->is_stopped_) {
 
-        cout << "listening..." << endl;
+        LOG_INFO("listening...");
 
         // accept
-        struct sockaddr_in client_addr{};
+        struct sockaddr_storage client_addr{};
         socklen_t client_addr_len = sizeof(client_addr);
 
         int new_connection_fd = accept(socket_fd, (struct sockaddr *)& client_addr, &client_addr_len);
 
         if (new_connection_fd < 0) {
+            if (this->is_stopped_) {
+                break;
+            }
             perror("Error: accept");
             continue;
         } else {
-            char clientIP[INET_ADDRSTRLEN] = "";
-            inet_ntop(AF_INET, &client_addr.sin_addr, clientIP, INET_ADDRSTRLEN);
-            cout << "remote client from " << clientIP << ":" << ntohs(client_addr.sin_port) << endl;
+            this->options_.socket_options.Apply(new_connection_fd);
+
+            char clientIP[INET_ADDRSTRLEN] = "unix";
+            if (client_addr.ss_family == AF_INET) {
+                auto client_addr_in = (struct sockaddr_in *)& client_addr;
+                inet_ntop(AF_INET, &client_addr_in->sin_addr, clientIP, INET_ADDRSTRLEN);
+                LOG_INFO("remote client from " << clientIP << ":" << ntohs(client_addr_in->sin_port));
+            } else {
+                LOG_INFO("remote client from " << this->host_);
+            }
 
             // generate a thread name
             long thread_name = std::clock();
@@ -79,14 +156,17 @@ Server::Server(const string& host, int port, int timeout) {
 
             // 启动线程
             this->vector_threads_.emplace_back(
-                    thread(&Server::SocketHandle, this, new_connection_fd, clientIP, thread_name));
+                    thread(&Server::SocketHandle, this, new_connection_fd, clientIP, thread_name,
+                           this->connection_count_++));
         }
 
         // sleep 1 micro_seconds
         usleep(1);
     }
 
+    this->listen_fd_ = -1;
     shutdown(socket_fd, SHUT_RDWR);
+    close(socket_fd);
 
     int thread_count = this->vector_threads_.size();
 
@@ -106,6 +186,22 @@ Server::Server(const string& host, int port, int timeout) {
 
 }
 
+/*!
+ * @brief stop accepting connections, Start() returns once the accepted ones are closed
+*/
+void Server::Stop() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_stop_);
+        this->is_stopped_ = true;
+    }
+    this->cv_stop_.notify_all();
+
+    int socket_fd = this->listen_fd_;
+    if (socket_fd != -1) {
+        shutdown(socket_fd, SHUT_RDWR);
+    }
+}
+
 
 /*!
  * @brief to judge whether the socket has timeout
@@ -114,7 +210,7 @@ void Server::TimeoutHandle() {
 
     auto timeout_value_ms = this->timeout_seconds_ * 1000;
 
-    while (true) {
+    while (!this->is_stopped_) {
 
         auto timestamp_now = Server::GetCurrentTimestamp();
 
@@ -136,7 +232,7 @@ void Server::TimeoutHandle() {
                         })
                         != this->map_latest_message_timestamp_.end()) {
 
-                cout << "# thread [" << output_thread_name << "] is timeout, removed from map_timestamp" << endl;
+                LOG_INFO("# thread [" << output_thread_name << "] is timeout, removed from map_timestamp");
                 this->map_latest_message_timestamp_.erase(output_thread_name);
             } else {
                 // cout << "do not timeout: " << output_thread_name << endl;
@@ -146,10 +242,37 @@ void Server::TimeoutHandle() {
 
 //        cout << ".." << endl;
 
-        // sleep in seconds
-        sleep(this->timeout_seconds_);
+        // sleep in seconds, or until Stop()
+        std::unique_lock<std::mutex> lock(this->mutex_stop_);
+        this->cv_stop_.wait_for(lock, std::chrono::seconds(this->timeout_seconds_),
+                                [this] { return this->is_stopped_.load(); });
+    }
+
+}
+
+/*!
+ * @brief pin the calling connection thread to the cpus of a NUMA node, or release it from the accepting cpus
+ * @param[in] connection_index count of connections accepted before, the connection goes to node index % nodes
+*/
+void Server::PinConnection(long connection_index) {
+    if (this->vector_node_cpus_.empty()) {
+        return;
     }
 
+    if (this->options_.is_connection_numa_pinned) {
+        long node = connection_index % (long) this->vector_node_cpus_.size();
+
+        CpuTopology::PinThread(pthread_self(), this->vector_node_cpus_[node]);
+        LOG_DEBUG("connection pinned to NUMA node " << node);
+        return;
+    }
+
+    // a thread inherits the cpus of the thread starting it, a connection of a pinned acceptor may run on any cpu
+    vector<int> vector_cpus;
+    for (const auto& item : this->vector_node_cpus_) {
+        vector_cpus.insert(vector_cpus.end(), item.begin(), item.end());
+    }
+    CpuTopology::PinThread(pthread_self(), vector_cpus);
 }
 
 /*!
@@ -157,11 +280,48 @@ void Server::TimeoutHandle() {
  * @param[in] connection_fd
  * @param[in] client_address
  * @param[in] thread_name
+ * @param[in] connection_index count of connections accepted before this one
 */
-void Server::SocketHandle(int connection_fd, const string& client_address, long thread_name) {
+void Server::SocketHandle(int connection_fd, const string& client_address, long thread_name, long connection_index) {
+
+    LOG_INFO("accepted connection from " << client_address);
+
+    // before the Message allocates its buffers, so they are first touched on the node of the connection
+    this->PinConnection(connection_index);
+
+    Message message(connection_fd, client_address);
+    message.SetQuickAck(this->options_.socket_options.is_quick_ack);
+
+    // never fall back to plain text when TLS is asked for
+    if (this->options_.tls_options.is_enabled && !SocketAddress::IsUnix(this->host_) &&
+        (!this->tls_context_ || !message.StartTls(this->tls_context_))) {
+        LOG_WARNING("TLS handshake with " << client_address << " failed");
+
+        LOG_INFO("shutdown connection_fd");
+        shutdown(connection_fd, SHUT_RDWR);
+        return;
+    }
+
+    if (this->options_.is_zero_copy) {
+        message.SetZeroCopy(true);
+    }
 
-    cout << "accepted connection from " << client_address << endl;
-    auto message = Message(connection_fd, client_address);
+    // images of the connection, kept across frames so a steady stream decodes into the same allocations
+    vector<cv::Mat> vector_mat_decoded;
+    vector<cv::Mat> vector_mat_raw(1);
+
+    // logical streams multiplexed over this connection, frames of a stream are processed in order
+    map<long, StreamState> map_streams;
+
+    // live streams read the next frame while the previous one is processed, to drop what comes too late,
+    // and a pipeline reads ahead to keep its stages busy
+    if (this->IsDropping() || this->IsStaged()) {
+        this->QueueHandle(message, connection_fd, client_address, thread_name, connection_index);
+
+        LOG_INFO("shutdown connection_fd");
+        shutdown(connection_fd, SHUT_RDWR);
+        return;
+    }
 
     // receive messages from socket client
     // flag of loop
@@ -177,7 +337,7 @@ void Server::SocketHandle(int connection_fd, const string& client_address, long
                 != this->map_latest_message_timestamp_.end()) {
 
             } else {
-                cout << "do not find [" << thread_name << "] in map_loop, BREAK while loop" << endl;
+                LOG_INFO("do not find [" << thread_name << "] in map_loop, BREAK while loop");
                 break;
             }
         }
@@ -194,31 +354,57 @@ void Server::SocketHandle(int connection_fd, const string& client_address, long
 
             message.GetImageBufferResult(output_buffer, output_length);
 
-            if (output_length > 0) {
+            // one image for "binary/image" and "binary/mat", one per item for "binary/image-batch"
+            auto& vector_mat_image = message.GetMatResult(vector_mat_raw[0]) ? vector_mat_raw : vector_mat_decoded;
+
+            bool is_decoded = &vector_mat_image == &vector_mat_decoded;
+            if (is_decoded) {
+                vector_mat_image.resize(message.GetImageCount());
+            }
+
+            if (!vector_mat_image.empty()) {
+
+                LOG_FRAME("# received " << output_length << " bytes from client " << client_address << ", stream "
+                          << message.GetStreamId() << ", in thread [" << thread_name << "]");
 
-                std::vector<uchar> vector_image(output_buffer, output_buffer + output_length);
+                bool is_write_succeed = false;
 
-                cout << "# received " << output_length << " bytes from client " << client_address << ", in thread [" << thread_name << "]"  <<  endl;
+                // decoded, processed and encoded on this thread, or as one task on the processing pool
+                this->RunProcessing(connection_index, message.GetStreamId(), message.GetPriority(), vector_mat_image.size(), [&]() {
+                    // raw pixels need no decoding
+                    if (is_decoded) {
+                        for (size_t i = 0; i < vector_mat_image.size(); i++) {
+                            unsigned char *item_buffer;
+                            long item_length = 0;
+                            message.GetImageBufferResult(i, item_buffer, item_length);
 
-                cv::Mat mat_image;
-                cv::imdecode(vector_image, cv::ImreadModes::IMREAD_COLOR, &mat_image);
+                            ImageCodec::Decode(item_buffer, item_length, this->options_.decode_options, vector_mat_image[i]);
+                        }
+                    }
 
-                // release vector
-                vector_image.clear();
-                vector<uchar>().swap(vector_image);
+                    auto& stream = this->GetStreamState(map_streams, message.GetStreamId());
+                    stream.frame_count++;
+                    stream.latest_timestamp = Server::GetCurrentTimestamp();
 
-                // TODO: process cv::Mat image object here
+                    Server::ProcessImages(stream, vector_mat_image);
 
-                // send cv::Mat image to client
-                bool is_write_succeed = message.WriteImage(mat_image);
+                    // send cv::Mat image objects to client, in the same shape and stream as the request
+                    if (message.GetContentType() == "binary/image-batch") {
+                        is_write_succeed = message.WriteImages(vector_mat_image);
+                    } else if (message.GetContentType() == "binary/mat") {
+                        is_write_succeed = message.WriteMat(vector_mat_image[0]);
+                    } else {
+                        is_write_succeed = message.WriteImage(vector_mat_image[0]);
+                    }
+                });
 
-                // release cv::Mat image object
-                mat_image.release();
+                // drop the header over the received pixels, decoded images stay allocated for the next frame
+                vector_mat_raw[0].release();
 
                 if (!is_write_succeed)
                 {
                     // meet socket error
-                    cout << "write socket error, remote socket maybe closed, BREAK while loop" << endl;
+                    LOG_WARNING("write socket error, remote socket maybe closed, BREAK while loop");
                     break;
                 }
 
@@ -226,7 +412,7 @@ void Server::SocketHandle(int connection_fd, const string& client_address, long
 
         } else {
             // if we got error of socket, break while loop
-            cout << "read socket error, remote socket maybe closed, BREAK while loop" << endl;
+            LOG_WARNING("read socket error, remote socket maybe closed, BREAK while loop");
 
             break;
         }
@@ -245,7 +431,7 @@ void Server::SocketHandle(int connection_fd, const string& client_address, long
                 this->map_latest_message_timestamp_[thread_name] = Server::GetCurrentTimestamp();
 
             } else {
-                cout << "do not find [" << thread_name << "] in map_loop, BREAK while loop" << endl;
+                LOG_INFO("do not find [" << thread_name << "] in map_loop, BREAK while loop");
                 break;
             }
         }
@@ -254,11 +440,437 @@ void Server::SocketHandle(int connection_fd, const string& client_address, long
         usleep(1);
     }
 
-    cout << "shutdown connection_fd" << endl;
+    LOG_INFO("shutdown connection_fd");
     shutdown(connection_fd, SHUT_RDWR);
 }
 
 
+/*!
+ * @brief read frames and write answers of one connection, frames are queued by the drop policy of their stream
+ * @param[in] message Message of the connection
+ * @param[in] connection_fd socket of the connection, polled with the answers of the processing thread
+ * @param[in] client_address
+ * @param[in] thread_name
+ * @param[in] connection_index count of connections accepted before this one, unique per connection
+*/
+void Server::QueueHandle(Message& message, int connection_fd, const string& client_address, long thread_name,
+                         long connection_index) {
+    StreamQueue stream_queue(this->options_.drop_policy, this->options_.map_drop_policies, this->options_.max_queue_length);
+
+    thread thread_process(this->IsStaged() ? &Server::PipelineHandle : &Server::ProcessHandle, this,
+                          std::ref(stream_queue), connection_index);
+
+    vector<StreamAnswer> vector_answers;
+
+    // the socket brings frames, the event fd brings answers
+    struct pollfd array_fds[2]{};
+    array_fds[0].fd = connection_fd;
+    array_fds[0].events = POLLIN;
+    array_fds[1].fd = stream_queue.GetEventFd();
+    array_fds[1].events = POLLIN;
+
+    while (this->IsThreadAlive(thread_name, false)) {
+
+        // shared memory can not be polled, its frames are answered before the next one is read
+        if (message.IsShmTransport()) {
+            bool is_written = true;
+            while (is_written && stream_queue.HasPendingAnswers()) {
+                stream_queue.WaitAnswers();
+                is_written = Server::WriteAnswers(message, stream_queue, vector_answers);
+            }
+            if (!is_written) {
+                break;
+            }
+        }
+
+        // wake up every second to check the timeout
+        bool is_readable = message.IsReadBuffered() || message.IsShmTransport();
+        if (!is_readable) {
+            if (poll(array_fds, 2, 1000) == -1 && errno != EINTR) {
+                perror("Error: poll");
+                break;
+            }
+            is_readable = array_fds[0].revents != 0;
+        }
+
+        if (!Server::WriteAnswers(message, stream_queue, vector_answers)) {
+            LOG_WARNING("write socket error, remote socket maybe closed, BREAK while loop");
+            break;
+        }
+
+        if (!is_readable) {
+            continue;
+        }
+
+        message.Clear();
+
+        if (!message.Read()) {
+            LOG_WARNING("read socket error, remote socket maybe closed, BREAK while loop");
+            break;
+        }
+
+        // the content is copied, the Message reads the next frame over it
+        StreamFrame frame;
+        frame.stream_id = message.GetStreamId();
+        frame.content_type = message.GetContentType();
+        frame.priority = message.GetPriority();
+
+        // the encode stage encodes as this Message would now
+        if (this->IsStaged()) {
+            message.GetImencodeParams(frame.format, frame.imencode_params);
+        }
+
+        cv::Mat mat_raw;
+        if (message.GetMatResult(mat_raw)) {
+            frame.mat_raw = mat_raw.clone();
+        } else {
+            for (int i = 0; i < message.GetImageCount(); i++) {
+                unsigned char *item_buffer;
+                long item_length = 0;
+                message.GetImageBufferResult(i, item_buffer, item_length);
+
+                frame.vector_encoded.emplace_back(item_buffer, item_buffer + item_length);
+            }
+        }
+
+        if (frame.mat_raw.empty() && frame.vector_encoded.empty()) {
+            continue;
+        }
+
+        LOG_FRAME("# received a frame of stream " << frame.stream_id << " from client " << client_address
+                  << ", in thread [" << thread_name << "]");
+
+        if (!stream_queue.Push(frame) || !this->IsThreadAlive(thread_name, true)) {
+            break;
+        }
+    }
+
+    stream_queue.Stop();
+    thread_process.join();
+}
+
+/*!
+ * @brief processing thread of a connection, decodes and processes the frames taken from stream_queue
+ * @param[in,out] stream_queue frames of the connection
+ * @param[in] connection_id index of the connection, unique, frames of one connection and stream are one flow
+*/
+void Server::ProcessHandle(StreamQueue& stream_queue, long connection_id) {
+    // only this thread touches the states of the streams
+    map<long, StreamState> map_streams;
+
+    StreamFrame frame;
+
+    while (stream_queue.Pop(frame)) {
+        vector<cv::Mat> vector_mat_image;
+
+        this->RunProcessing(connection_id, frame.stream_id, frame.priority, std::max<long>(frame.vector_encoded.size(), 1), [&]() {
+            this->DecodeFrame(frame, vector_mat_image);
+
+            auto& stream = this->GetStreamState(map_streams, frame.stream_id);
+            stream.frame_count++;
+            stream.latest_timestamp = Server::GetCurrentTimestamp();
+
+            Server::ProcessImages(stream, vector_mat_image);
+        });
+
+        stream_queue.Complete(frame, vector_mat_image);
+    }
+}
+
+/*!
+ * @brief processing thread of a connection running decode, process and encode as stages, so the codec work of
+ *        some frames overlaps the processing of another, the process stage runs on this thread
+ * @param[in,out] stream_queue frames of the connection
+ * @param[in] connection_id index of the connection, unique, frames of one connection and stream are one flow
+*/
+void Server::PipelineHandle(StreamQueue& stream_queue, long connection_id) {
+    FramePipeline pipeline(this->options_.stage_queue_length);
+
+    vector<thread> vector_threads;
+
+    int decode_thread_count = std::max(this->options_.decode_stage_thread_count, 1);
+    pipeline.decode_thread_count = decode_thread_count;
+    for (int i = 0; i < decode_thread_count; i++) {
+        vector_threads.emplace_back(&Server::DecodeStageHandle, this, std::ref(stream_queue), std::ref(pipeline));
+    }
+
+    for (int i = 0; i < std::max(this->options_.encode_stage_thread_count, 1); i++) {
+        vector_threads.emplace_back(&Server::EncodeStageHandle, this, std::ref(stream_queue), std::ref(pipeline));
+    }
+
+    // only this thread touches the states of the streams, it sees their frames in order
+    map<long, StreamState> map_streams;
+
+    long sequence = 0;
+    StagedFrame staged;
+
+    while (pipeline.queue_decoded.Pop(sequence, staged)) {
+        const auto& frame = staged.frame;
+
+        this->RunProcessing(connection_id, frame.stream_id, frame.priority, std::max<long>(frame.vector_encoded.size(), 1), [&]() {
+            auto& stream = this->GetStreamState(map_streams, frame.stream_id);
+            stream.frame_count++;
+            stream.latest_timestamp = Server::GetCurrentTimestamp();
+
+            Server::ProcessImages(stream, staged.vector_mat_image);
+        });
+
+        pipeline.queue_processed.Push(sequence, staged);
+    }
+
+    pipeline.queue_processed.Close();
+
+    for (auto& item : vector_threads) {
+        item.join();
+    }
+}
+
+/*!
+ * @brief decode stage of a pipeline, runs until the StreamQueue stops
+ * @param[in,out] stream_queue frames of the connection
+ * @param[in,out] pipeline stages of the connection
+*/
+void Server::DecodeStageHandle(StreamQueue& stream_queue, FramePipeline& pipeline) {
+    StagedFrame staged;
+
+    while (true) {
+        long sequence;
+        {
+            std::lock_guard<std::mutex> lockGuard(pipeline.mutex_pop);
+            if (!stream_queue.Pop(staged.frame)) {
+                break;
+            }
+            sequence = pipeline.next_sequence++;
+        }
+
+        staged.vector_mat_image.clear();
+        this->DecodeFrame(staged.frame, staged.vector_mat_image);
+
+        pipeline.queue_decoded.Push(sequence, staged);
+    }
+
+    if (--pipeline.decode_thread_count == 0) {
+        pipeline.queue_decoded.Close();
+    }
+}
+
+/*!
+ * @brief encode stage of a pipeline, runs until the process stage ends
+ * @param[in,out] stream_queue frames of the connection
+ * @param[in,out] pipeline stages of the connection
+*/
+void Server::EncodeStageHandle(StreamQueue& stream_queue, FramePipeline& pipeline) {
+    long sequence = 0;
+    StagedFrame staged;
+
+    while (pipeline.queue_processed.Pop(sequence, staged)) {
+        const auto& frame = staged.frame;
+        auto& vector_mat_image = staged.vector_mat_image;
+
+        // raw pixels go back as they are, a "binary/image" answer is its first image
+        bool is_encoded = frame.content_type != "binary/mat" && !vector_mat_image.empty();
+        size_t image_count = frame.content_type == "binary/image-batch" ? vector_mat_image.size() : 1;
+
+        staged.vector_encoded.resize(is_encoded ? image_count : 0);
+        for (size_t i = 0; i < staged.vector_encoded.size(); i++) {
+            // the reading thread encodes what fails here
+            if (!ImageCodec::Encode(vector_mat_image[i], frame.format, frame.imencode_params, staged.vector_encoded[i])) {
+                staged.vector_encoded.clear();
+                break;
+            }
+        }
+
+        stream_queue.Complete(frame, vector_mat_image, staged.vector_encoded);
+    }
+}
+
+/*!
+ * @brief decode the images of a frame
+ * @param[in] frame received frame
+ * @param[out] vector_mat_image decoded images, or a header over the raw pixels of "binary/mat"
+*/
+void Server::DecodeFrame(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image) const {
+    // raw pixels need no decoding
+    if (!frame.mat_raw.empty()) {
+        vector_mat_image.push_back(frame.mat_raw);
+        return;
+    }
+
+    vector_mat_image.resize(frame.vector_encoded.size());
+
+    for (size_t i = 0; i < vector_mat_image.size(); i++) {
+        const auto& vector_encoded = frame.vector_encoded[i];
+        ImageCodec::Decode(vector_encoded.data(), vector_encoded.size(), this->options_.decode_options,
+                           vector_mat_image[i]);
+    }
+}
+
+/*!
+ * @brief write the answers which are ready, in the shape and stream of their frames
+ * @param[in] message Message of the connection
+ * @param[in,out] stream_queue frames of the connection
+ * @param[in,out] vector_answers answers, kept to reuse its capacity
+ * @return true=succeed, false=socket error
+*/
+bool Server::WriteAnswers(Message& message, StreamQueue& stream_queue, vector<StreamAnswer>& vector_answers) {
+    stream_queue.TakeAnswers(vector_answers);
+
+    // encoded answers of a pipeline
+    vector<iovec> vector_iov;
+
+    for (auto& answer : vector_answers) {
+        message.Clear();
+        message.SetStreamId(answer.stream_id);
+
+        // every frame is answered, so a client sending ahead can match answers to frames
+        bool is_write_succeed;
+        if (answer.is_dropped) {
+            is_write_succeed = message.WriteStatus("dropped");
+        } else if (answer.vector_mat_image.empty()) {
+            is_write_succeed = message.WriteStatus("empty");
+        } else if (!answer.vector_encoded.empty()) {
+            vector_iov.clear();
+            for (const auto& vector_image : answer.vector_encoded) {
+                vector_iov.push_back({(void*) vector_image.data(), vector_image.size()});
+            }
+            is_write_succeed = message.WriteEncodedImages(vector_iov.data(), vector_iov.size(),
+                                                          answer.content_type == "binary/image-batch");
+        } else if (answer.content_type == "binary/image-batch") {
+            is_write_succeed = message.WriteImages(answer.vector_mat_image);
+        } else if (answer.content_type == "binary/mat") {
+            is_write_succeed = message.WriteMat(answer.vector_mat_image[0]);
+        } else {
+            is_write_succeed = message.WriteImage(answer.vector_mat_image[0]);
+        }
+
+        if (!is_write_succeed) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * @brief check whether the thread of a connection is still in the timeout map
+ * @param[in] thread_name
+ * @param[in] is_touched true=a message arrived, restart the timeout
+ * @return true=alive, false=timed out
+*/
+bool Server::IsThreadAlive(long thread_name, bool is_touched) {
+    std::lock_guard<std::mutex> lockGuard(mutex_ticks_map);
+
+    auto iter = this->map_latest_message_timestamp_.find(thread_name);
+    if (iter == this->map_latest_message_timestamp_.end()) {
+        LOG_INFO("do not find [" << thread_name << "] in map_loop, BREAK while loop");
+        return false;
+    }
+
+    if (is_touched) {
+        iter->second = Server::GetCurrentTimestamp();
+    }
+    return true;
+}
+
+/*!
+ * @brief run the decoding and processing of a frame, on the calling thread or on a processing pool
+ * @param[in] connection_id index of the connection, unique, frames of one connection and stream are one flow
+ * @param[in] stream_id stream of the frame
+ * @param[in] priority "priority" of the frame
+ * @param[in] image_count count of images of the frame, the cost of the job
+ * @param[in] job decoding and processing
+*/
+void Server::RunProcessing(long connection_id, long stream_id, const string& priority, long image_count,
+                           const function<void()>& job) {
+    // the pool takes frames in any order, no priorities
+    if (this->work_stealing_pool_) {
+        this->work_stealing_pool_->Run(connection_id, job);
+        return;
+    }
+
+    if (!this->frame_scheduler_) {
+        job();
+        return;
+    }
+
+    // the server's setting for the stream wins over what the client asks for
+    PriorityClass priority_class = this->options_.default_priority;
+    auto iter = this->options_.map_stream_priorities.find(stream_id);
+    if (iter != this->options_.map_stream_priorities.end()) {
+        priority_class = iter->second;
+    } else {
+        FrameScheduler::ParsePriority(priority, priority_class);
+    }
+
+    this->frame_scheduler_->Run({connection_id, stream_id}, priority_class, image_count, job);
+}
+
+/*!
+ * @brief check whether any stream may drop frames
+ * @return true=frames are read and processed on separate threads
+*/
+bool Server::IsDropping() const {
+    if (this->options_.drop_policy != DropPolicy::Queue) {
+        return true;
+    }
+
+    for (const auto& item : this->options_.map_drop_policies) {
+        if (item.second != DropPolicy::Queue) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief check whether frames run through a pipeline of stages
+ * @return true=decode, process and encode on separate threads
+*/
+bool Server::IsStaged() const {
+    return this->options_.decode_stage_thread_count > 0;
+}
+
+/*!
+ * @brief get the state of a stream, a new stream replaces the least recently seen one when the connection is full
+ * @param[in,out] map_streams streams of the connection
+ * @param[in] stream_id stream of the message
+ * @return state of the stream
+*/
+StreamState& Server::GetStreamState(map<long, StreamState>& map_streams, long stream_id) const {
+    auto iter = map_streams.find(stream_id);
+    if (iter != map_streams.end()) {
+        return iter->second;
+    }
+
+    if ((int) map_streams.size() >= std::max(this->options_.max_stream_count, 1)) {
+        auto iter_oldest = std::min_element(map_streams.begin(), map_streams.end(),
+                                            [](const map<long, StreamState>::value_type& a,
+                                               const map<long, StreamState>::value_type& b) {
+                                                return a.second.latest_timestamp < b.second.latest_timestamp;
+                                            });
+
+        LOG_INFO("stream " << iter_oldest->first << " is idle, removed for stream " << stream_id);
+        map_streams.erase(iter_oldest);
+    }
+
+    LOG_DEBUG("new stream " << stream_id);
+
+    auto& stream = map_streams[stream_id];
+    stream.stream_id = stream_id;
+    return stream;
+}
+
+/*!
+ * @brief process the images of one message, a batch arrives as a whole so models can run batched inference
+ * @param[in,out] stream state of the stream the images belong to
+ * @param[in,out] vector_mat_image cv::Mat image objects, replaced by the images to send back
+*/
+void Server::ProcessImages(StreamState& stream, vector<cv::Mat>& vector_mat_image) {
+    // no model is built in, the images are sent back as they are
+    (void) stream;
+    (void) vector_mat_image;
+}
+
 /*!
  * @brief get current time ticks
  * @return ticks long
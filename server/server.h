@@ -1,6 +1,8 @@
 #ifndef SERVER_SERVER_H
 #define SERVER_SERVER_H
 
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
 #include <iostream>
 #include <thread>
@@ -14,22 +16,111 @@
 
 #include "json.hpp"
 #include "message.h"
+#include "socket_address.h"
+#include "socket_options.h"
+#include "tls_session.h"
+#include "cpu_topology.h"
+#include "frame_pipeline.h"
+#include "frame_scheduler.h"
+#include "stream_queue.h"
+#include "work_stealing_pool.h"
 
 using namespace std;
 using namespace cv;
 using namespace std::chrono;
 
+// options of Server, defaults decode every request at full size
+struct ServerOptions {
+    // scaled / cropped decode of jpg requests, e.g. target_size of the model input
+    DecodeOptions decode_options;
+
+    // most streams of one connection, the least recently seen stream is dropped for a new one
+    int max_stream_count = 1024;
+
+    // what a stream does with frames arriving faster than they are processed, e.g. LatestOnly for live cameras,
+    // any policy but Queue reads frames on one thread and processes them on another
+    DropPolicy drop_policy = DropPolicy::Queue;
+
+    // policies of single streams, <stream_id, policy>, overriding drop_policy
+    map<long, DropPolicy> map_drop_policies;
+
+    // most frames waiting per stream before Queue stops reading and DropOldest drops
+    int max_queue_length = 4;
+
+    // threads processing the frames of every connection by priority, 0 = each connection processes its own
+    int process_thread_count = 0;
+
+    // priority class of a stream whose frames ask for none
+    PriorityClass default_priority = PriorityClass::Normal;
+
+    // priority classes of single streams, <stream_id, class>, overriding the "priority" of their frames
+    map<long, PriorityClass> map_stream_priorities;
+
+    // share of the processing threads of each class while every class has frames waiting
+    map<PriorityClass, int> map_priority_weights{
+            {PriorityClass::Critical, 16}, {PriorityClass::Normal, 4}, {PriorityClass::Bulk, 1}};
+
+    // process on a work-stealing pool instead of the priority scheduler, for many cores and equal streams
+    bool is_work_stealing = false;
+
+    // pin the threads of the processing pool to cpus spread over the NUMA nodes, work-stealing threads steal from
+    // their own node first
+    bool is_numa_pinned = false;
+
+    // cpus of the accepting thread and the timeout daemon, a kernel cpu list like "0-1", empty = not pinned
+    string acceptor_cpus;
+
+    // TCP_NODELAY, buffer sizes, quick acks and busy polling of the listening and accepted sockets
+    SocketOptions socket_options;
+
+    // send large answers of tcp connections with MSG_ZEROCOPY, for high bandwidth links, over loopback the kernel
+    // copies them anyway
+    bool is_zero_copy = false;
+
+    // encrypt tcp connections, a client that does not complete the handshake is refused
+    TlsOptions tls_options;
+
+    // pin the thread of each connection, and the threads it starts, to the cpus of one NUMA node, connections take
+    // turns over the nodes, the buffers of a connection are first touched there and so allocated on its node
+    bool is_connection_numa_pinned = false;
+
+    // threads decoding the frames of a connection ahead of its processing, 0 = decode, process and encode
+    // one frame after another, any other count runs them as stages overlapping across frames
+    int decode_stage_thread_count = 0;
+
+    // threads encoding the answers of a connection behind its processing, with decode_stage_thread_count only
+    int encode_stage_thread_count = 1;
+
+    // most frames waiting between two stages
+    int stage_queue_length = 4;
+};
+
+// processing state of one logical stream, e.g. a camera, many streams share one connection and its buffers
+struct StreamState {
+    long stream_id = 0;
+
+    // count of frames processed
+    long frame_count = 0;
+
+    // time of the latest frame, in milli seconds
+    long latest_timestamp = 0;
+};
+
 
 class Server {
 
 public:
-    Server(const string& host, int port, int timeout);
+    Server(const string& host, int port, int timeout, const ServerOptions& options = ServerOptions());
+
+    ~Server();
 
-    [[noreturn]] void Start();
+    void Start();
+
+    void Stop();
 
 private:
-    // host address
-    const char* host_;
+    // host address, or unix socket endpoint
+    string host_;
 
     //port number
     int port_;
@@ -37,6 +128,23 @@ private:
     // seconds of timeout
     int timeout_seconds_;
 
+    ServerOptions options_;
+
+    // processing pool shared by the connections, nullptr when options_.process_thread_count is 0
+    unique_ptr<FrameScheduler> frame_scheduler_;
+
+    // set instead of frame_scheduler_ when options_.is_work_stealing
+    unique_ptr<WorkStealingPool> work_stealing_pool_;
+
+    // certificate of the server, nullptr when TLS is off
+    shared_ptr<TlsContext> tls_context_;
+
+    // cpus of each NUMA node, empty when no thread of the server is pinned
+    vector<vector<int>> vector_node_cpus_;
+
+    // count of accepted connections, only touched by the accepting thread
+    long connection_count_ = 0;
+
     // vector of socket threads
     vector<thread> vector_threads_;
 
@@ -46,11 +154,65 @@ private:
     // daemon thread of timeout
     thread thread_timeout_daemon_;
 
+    // listening socket of Start(), -1 before it listens
+    atomic<int> listen_fd_{-1};
+
+    // set by Stop(), Start() and the timeout daemon return
+    atomic<bool> is_stopped_{false};
+
+    // wakes the timeout daemon on Stop()
+    mutex mutex_stop_;
+    condition_variable cv_stop_;
+
+    // pin the calling connection thread by options_
+    void PinConnection(long connection_index);
+
     // socket function in thread
-    void SocketHandle(int connection_fd, const string& client_address, long thread_name);
+    void SocketHandle(int connection_fd, const string& client_address, long thread_name, long connection_index);
+
+    // read frames into per-stream queues and write the answers, while ProcessHandle() processes them
+    void QueueHandle(Message& message, int connection_fd, const string& client_address, long thread_name,
+                     long connection_index);
+
+    // process the frames of a StreamQueue until it stops
+    void ProcessHandle(StreamQueue& stream_queue, long connection_id);
+
+    // process the frames of a StreamQueue on a pipeline of stages until it stops, on this thread
+    void PipelineHandle(StreamQueue& stream_queue, long connection_id);
+
+    // decode stage of a pipeline, takes frames from the StreamQueue
+    void DecodeStageHandle(StreamQueue& stream_queue, FramePipeline& pipeline);
+
+    // encode stage of a pipeline, hands the answers back to the StreamQueue
+    void EncodeStageHandle(StreamQueue& stream_queue, FramePipeline& pipeline);
+
+    // decode the images of a frame, or take its raw pixels
+    void DecodeFrame(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image) const;
+
+    // write the answers of a StreamQueue which are ready
+    static bool WriteAnswers(Message& message, StreamQueue& stream_queue, vector<StreamAnswer>& vector_answers);
+
+    // decode and process a frame, on a processing pool when there is one
+    void RunProcessing(long connection_id, long stream_id, const string& priority, long image_count,
+                       const function<void()>& job);
+
+    // check whether the connection has not timed out, and record a message
+    bool IsThreadAlive(long thread_name, bool is_touched);
+
+    // check whether frames of a connection may be dropped
+    bool IsDropping() const;
+
+    // check whether frames of a connection run through a pipeline of stages
+    bool IsStaged() const;
+
+    // get the state of a stream of a connection, created on its first frame
+    StreamState& GetStreamState(map<long, StreamState>& map_streams, long stream_id) const;
+
+    // process the decoded images of one message
+    static void ProcessImages(StreamState& stream, vector<cv::Mat>& vector_mat_image);
 
     // timeout function in thread
-    [[noreturn]] void TimeoutHandle();
+    void TimeoutHandle();
 
     // get current time ticks
     static long GetCurrentTimestamp();
@@ -0,0 +1,335 @@
+#include "shm_channel.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*!
+ * @brief init ShmChannel Class
+ * @param[in] socket_fd socket of the connection which negotiated the channel
+*/
+ShmChannel::ShmChannel(int socket_fd) {
+    this->socket_fd_ = socket_fd;
+}
+
+/*!
+ * @brief mark the channel closed for the peer and unmap it
+*/
+ShmChannel::~ShmChannel() {
+    if (this->header_ != nullptr) {
+        this->header_->is_closed = 1;
+
+        // wake the peer, it notices is_closed at once
+        for (auto& ring : this->header_->rings) {
+            sem_post(&ring.sem_readable);
+            sem_post(&ring.sem_writable);
+        }
+    }
+
+    if (this->mapped_address_ != nullptr) {
+        munmap(this->mapped_address_, this->mapped_length_);
+    }
+
+    if (this->is_creator_) {
+        this->Unlink();
+    }
+}
+
+/*!
+ * @brief create and map a new shared memory object, called by the client
+ * @param[in] name shm name, e.g. "/cpp_socket_demo_1234_5"
+ * @param[in] capacity bytes of each ring
+ * @return true=succeed, false=failed
+*/
+bool ShmChannel::Create(const string& name, long capacity) {
+    int shm_fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (shm_fd == -1) {
+        perror("Error: shm_open");
+        return false;
+    }
+
+    this->name_ = name;
+    this->is_creator_ = true;
+
+    long length = ShmChannel::GetMappedLength(capacity);
+
+    if (ftruncate(shm_fd, length) == -1 || !this->Map(shm_fd, length)) {
+        perror("Error: ftruncate");
+        close(shm_fd);
+        this->Unlink();
+        return false;
+    }
+    close(shm_fd);
+
+    this->capacity_ = capacity;
+
+    this->header_ = new(this->mapped_address_) ShmHeader;
+    this->header_->capacity = capacity;
+    this->header_->is_closed = 0;
+
+    for (auto& ring : this->header_->rings) {
+        ring.head = 0;
+        ring.tail = 0;
+        sem_init(&ring.sem_readable, 1, 0);
+        sem_init(&ring.sem_writable, 1, 0);
+    }
+
+    this->header_->magic = ShmChannel::shm_magic_;
+
+    // the client reads what the server writes
+    this->Attach(1);
+    return true;
+}
+
+/*!
+ * @brief map a shared memory object created by the peer, called by the server
+ * @param[in] name shm name from the offer
+ * @return true=succeed, false=failed
+*/
+bool ShmChannel::Open(const string& name) {
+    int shm_fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (shm_fd == -1) {
+        perror("Error: shm_open");
+        return false;
+    }
+
+    struct stat shm_stat{};
+    if (fstat(shm_fd, &shm_stat) == -1 || shm_stat.st_size < (long) sizeof(ShmHeader) ||
+        !this->Map(shm_fd, shm_stat.st_size)) {
+        close(shm_fd);
+        return false;
+    }
+    close(shm_fd);
+
+    this->header_ = static_cast<ShmHeader*>(this->mapped_address_);
+
+    // the header is written by the peer, its capacity is read once and must fit the mapping
+    long capacity = this->header_->capacity;
+    if (this->header_->magic != ShmChannel::shm_magic_ || capacity <= 0 || capacity > this->mapped_length_ / 2 ||
+        ShmChannel::GetMappedLength(capacity) != this->mapped_length_) {
+        this->header_ = nullptr;
+        return false;
+    }
+    this->capacity_ = capacity;
+
+    this->name_ = name;
+
+    // the server reads what the client writes
+    this->Attach(0);
+    return true;
+}
+
+/*!
+ * @brief remove the shm name, the mappings stay valid until both sides unmap
+*/
+void ShmChannel::Unlink() {
+    if (!this->name_.empty()) {
+        shm_unlink(this->name_.c_str());
+        this->name_.clear();
+    }
+}
+
+/*!
+ * @brief read up to length bytes, blocks until at least one byte arrives, like recv()
+ * @param[out] buffer output buffer
+ * @param[in] length size of buffer
+ * @return count of bytes, 0 means the peer has gone
+*/
+long ShmChannel::Read(void* buffer, long length) {
+    unsigned long head;
+    unsigned long tail = this->read_ring_->tail.load(std::memory_order_relaxed);
+
+    while ((head = this->read_ring_->head.load(std::memory_order_acquire)) == tail) {
+        if (!this->Wait(&this->read_ring_->sem_readable)) {
+            return 0;
+        }
+    }
+
+    // a head beyond the ring is a broken peer
+    if (head - tail > (unsigned long) this->capacity_) {
+        return 0;
+    }
+
+    long count = std::min<long>(length, head - tail);
+    long offset = tail % this->capacity_;
+    long first = std::min(count, this->capacity_ - offset);
+
+    memcpy(buffer, &this->read_data_[offset], first);
+    memcpy((unsigned char*) buffer + first, this->read_data_, count - first);
+
+    this->read_ring_->tail.store(tail + count, std::memory_order_release);
+    ShmChannel::Notify(&this->read_ring_->sem_writable);
+
+    return count;
+}
+
+/*!
+ * @brief wait for the next length bytes when they lie in one piece in the ring, they stay there until Consume()
+ * @param[in] length bytes to read
+ * @return address of the bytes in the ring, nullptr if they wrap around its end or the peer has gone
+*/
+unsigned char* ShmChannel::Peek(long length) {
+    unsigned long tail = this->read_ring_->tail.load(std::memory_order_relaxed);
+    long offset = tail % this->capacity_;
+
+    // the writer never waits for them, the space up to tail + capacity_ is free
+    if (length <= 0 || length > this->capacity_ - offset) {
+        return nullptr;
+    }
+
+    while (this->read_ring_->head.load(std::memory_order_acquire) - tail < (unsigned long) length) {
+        if (!this->Wait(&this->read_ring_->sem_readable)) {
+            return nullptr;
+        }
+    }
+
+    return &this->read_data_[offset];
+}
+
+/*!
+ * @brief hand the bytes returned by Peek() back to the writer
+ * @param[in] length bytes to release
+*/
+void ShmChannel::Consume(long length) {
+    unsigned long tail = this->read_ring_->tail.load(std::memory_order_relaxed);
+
+    this->read_ring_->tail.store(tail + length, std::memory_order_release);
+    ShmChannel::Notify(&this->read_ring_->sem_writable);
+}
+
+/*!
+ * @brief write all length bytes, blocks while the ring is full, like a blocking send()
+ * @param[in] buffer input buffer
+ * @param[in] length size of buffer
+ * @return count of bytes, -1 means the peer has gone
+*/
+long ShmChannel::Write(const void* buffer, long length) {
+    long written = 0;
+
+    while (written < length) {
+        unsigned long head = this->write_ring_->head.load(std::memory_order_relaxed);
+        unsigned long tail = this->write_ring_->tail.load(std::memory_order_acquire);
+
+        // a tail beyond the head is a broken peer
+        if (head - tail > (unsigned long) this->capacity_) {
+            return -1;
+        }
+
+        long space = this->capacity_ - (long) (head - tail);
+        if (space == 0) {
+            if (!this->Wait(&this->write_ring_->sem_writable)) {
+                return -1;
+            }
+            continue;
+        }
+
+        long count = std::min(space, length - written);
+        long offset = head % this->capacity_;
+        long first = std::min(count, this->capacity_ - offset);
+
+        memcpy(&this->write_data_[offset], (const unsigned char*) buffer + written, first);
+        memcpy(this->write_data_, (const unsigned char*) buffer + written + first, count - first);
+
+        this->write_ring_->head.store(head + count, std::memory_order_release);
+        ShmChannel::Notify(&this->write_ring_->sem_readable);
+
+        written += count;
+    }
+
+    return written;
+}
+
+/*!
+ * @brief mmap the shared memory object
+ * @param[in] shm_fd shm file descriptor
+ * @param[in] length bytes to map
+ * @return true=succeed, false=failed
+*/
+bool ShmChannel::Map(int shm_fd, long length) {
+    void* address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (address == MAP_FAILED) {
+        perror("Error: mmap");
+        return false;
+    }
+
+    this->mapped_address_ = address;
+    this->mapped_length_ = length;
+    return true;
+}
+
+/*!
+ * @brief locate the rings of this side
+ * @param[in] read_index index of the ring to read, the other one is written
+*/
+void ShmChannel::Attach(int read_index) {
+    auto data = static_cast<unsigned char*>(this->mapped_address_) + ShmChannel::GetMappedLength(0);
+
+    this->read_ring_ = &this->header_->rings[read_index];
+    this->read_data_ = data + read_index * this->capacity_;
+
+    this->write_ring_ = &this->header_->rings[1 - read_index];
+    this->write_data_ = data + (1 - read_index) * this->capacity_;
+}
+
+/*!
+ * @brief wait for the peer to post sem, wakes every wait_interval_ms_ to check the peer
+ * @param[in] sem semaphore to wait
+ * @return true=wait again for data or space, false=the peer has gone
+*/
+bool ShmChannel::Wait(sem_t* sem) {
+    struct timespec deadline{};
+    clock_gettime(CLOCK_REALTIME, &deadline);
+
+    deadline.tv_nsec += ShmChannel::wait_interval_ms_ * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    if (sem_timedwait(sem, &deadline) == 0) {
+        return this->header_->is_closed == 0;
+    }
+
+    return this->IsPeerAlive();
+}
+
+/*!
+ * @brief check the closed flag and the socket of the connection
+ * @return true=peer is alive
+*/
+bool ShmChannel::IsPeerAlive() const {
+    if (this->header_->is_closed != 0) {
+        return false;
+    }
+
+    // recv() returns 0 only when the peer has shut the socket down
+    char data;
+    return recv(this->socket_fd_, &data, sizeof(data), MSG_PEEK | MSG_DONTWAIT) != 0;
+}
+
+/*!
+ * @brief post sem unless a wake up is already pending, so the count stays bounded
+ * @param[in] sem semaphore to post
+*/
+void ShmChannel::Notify(sem_t* sem) {
+    int value = 0;
+    sem_getvalue(sem, &value);
+    if (value <= 0) {
+        sem_post(sem);
+    }
+}
+
+/*!
+ * @brief get the size of the mapping, header aligned to a cache line and two rings
+ * @param[in] capacity bytes of each ring
+ * @return size of mapping
+*/
+long ShmChannel::GetMappedLength(long capacity) {
+    long header_length = (sizeof(ShmHeader) + 63) / 64 * 64;
+    return header_length + capacity * 2;
+}
@@ -0,0 +1,92 @@
+#ifndef SERVER_SHM_CHANNEL_H
+#define SERVER_SHM_CHANNEL_H
+
+#include <atomic>
+#include <string>
+#include <semaphore.h>
+
+using namespace std;
+
+
+// byte stream over shared memory between a client and a server on the same host,
+// one single-producer single-consumer ring per direction, Message framing is carried unchanged
+class ShmChannel {
+
+public:
+    explicit ShmChannel(int socket_fd);
+
+    ~ShmChannel();
+
+    bool Create(const string& name, long capacity);
+
+    bool Open(const string& name);
+
+    void Unlink();
+
+    long Read(void* buffer, long length);
+
+    unsigned char* Peek(long length);
+
+    void Consume(long length);
+
+    long Write(const void* buffer, long length);
+
+private:
+
+    static const unsigned long shm_magic_ = 0x534f434b53484d31;
+
+    static const int wait_interval_ms_ = 100;
+
+    struct RingHeader {
+        atomic<unsigned long> head;
+        atomic<unsigned long> tail;
+        // posted by the writer when data arrives, by the reader when space is freed
+        sem_t sem_readable;
+        sem_t sem_writable;
+    };
+
+    struct ShmHeader {
+        unsigned long magic;
+        long capacity;
+        atomic<int> is_closed;
+        // rings[0]: client to server, rings[1]: server to client
+        RingHeader rings[2];
+    };
+
+    // socket of the connection, used to notice a closed peer while waiting
+    int socket_fd_;
+
+    string name_;
+
+    bool is_creator_ = false;
+
+    void* mapped_address_ = nullptr;
+
+    long mapped_length_ = 0;
+
+    ShmHeader* header_ = nullptr;
+
+    RingHeader* read_ring_ = nullptr;
+
+    unsigned char* read_data_ = nullptr;
+
+    RingHeader* write_ring_ = nullptr;
+
+    unsigned char* write_data_ = nullptr;
+
+    long capacity_ = 0;
+
+    bool Map(int shm_fd, long length);
+
+    void Attach(int read_index);
+
+    bool Wait(sem_t* sem);
+
+    bool IsPeerAlive() const;
+
+    static void Notify(sem_t* sem);
+
+    static long GetMappedLength(long capacity);
+};
+
+#endif //SERVER_SHM_CHANNEL_H
@@ -0,0 +1,27 @@
+#ifndef SERVER_SOCKET_ADDRESS_H
+#define SERVER_SOCKET_ADDRESS_H
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+
+// endpoints are "a.b.c.d" for tcp, "unix:/path/to.sock" for a unix socket file
+// and "unix:@name" for a name in the linux abstract namespace
+class SocketAddress {
+
+public:
+    static bool IsUnix(const string& address);
+
+    static bool IsAbstract(const string& address);
+
+    static socklen_t MakeUnix(const string& address, struct sockaddr_un& unix_addr);
+
+private:
+
+    static const int unix_prefix_length_ = 5;
+};
+
+#endif //SERVER_SOCKET_ADDRESS_H
@@ -0,0 +1,66 @@
+#include "socket_options.h"
+#include "logger.h"
+
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+/*!
+ * @brief set the options on a socket, tcp options only on a tcp socket
+ * @param[in] socket_fd socket, before connect() or listen() for the buffer sizes to shape the window
+ * @return true=every option set, false=some failed, the socket still works with the others
+*/
+bool SocketOptions::Apply(int socket_fd) const {
+    struct sockaddr_storage socket_addr{};
+    socklen_t socket_addr_len = sizeof(socket_addr);
+
+    bool is_tcp = getsockname(socket_fd, (struct sockaddr *)& socket_addr, &socket_addr_len) == 0 &&
+                  (socket_addr.ss_family == AF_INET || socket_addr.ss_family == AF_INET6);
+
+    bool is_succeed = true;
+
+    if (this->send_buffer_size > 0) {
+        is_succeed &= SocketOptions::SetOption(socket_fd, SOL_SOCKET, SO_SNDBUF, this->send_buffer_size, "SO_SNDBUF");
+    }
+    if (this->receive_buffer_size > 0) {
+        is_succeed &= SocketOptions::SetOption(socket_fd, SOL_SOCKET, SO_RCVBUF, this->receive_buffer_size, "SO_RCVBUF");
+    }
+
+    // a unix socket has no Nagle, no acks and no device queue
+    if (!is_tcp) {
+        return is_succeed;
+    }
+
+    if (this->is_no_delay) {
+        is_succeed &= SocketOptions::SetOption(socket_fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (this->is_quick_ack) {
+        is_succeed &= SocketOptions::SetOption(socket_fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    }
+
+#ifdef SO_BUSY_POLL
+    if (this->busy_poll_us > 0) {
+        is_succeed &= SocketOptions::SetOption(socket_fd, SOL_SOCKET, SO_BUSY_POLL, this->busy_poll_us, "SO_BUSY_POLL");
+    }
+#endif
+
+    return is_succeed;
+}
+
+/*!
+ * @brief set one integer option
+ * @param[in] socket_fd socket
+ * @param[in] level level of setsockopt()
+ * @param[in] name name of setsockopt()
+ * @param[in] value value of the option
+ * @param[in] option_name name of the option for the log
+ * @return true=succeed, false=failed
+*/
+bool SocketOptions::SetOption(int socket_fd, int level, int name, int value, const string& option_name) {
+    if (setsockopt(socket_fd, level, name, &value, sizeof(value)) == -1) {
+        LOG_WARNING("failed to set " << option_name << " to " << value << ", error: " << errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,293 @@
+#include "stream_queue.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*!
+ * @brief init StreamQueue
+ * @param[in] default_policy policy of a stream without its own
+ * @param[in] map_policies policies of single streams, <stream_id, policy>
+ * @param[in] max_queue_length most frames waiting per stream, LatestOnly always keeps 1
+*/
+StreamQueue::StreamQueue(DropPolicy default_policy, const map<long, DropPolicy>& map_policies, int max_queue_length) {
+    this->default_policy_ = default_policy;
+    this->map_policies_ = map_policies;
+    this->max_queue_length_ = std::max(max_queue_length, 1);
+    this->last_stream_id_ = LONG_MIN;
+
+    this->event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (this->event_fd_ == -1) {
+        perror("Error: eventfd");
+    }
+}
+
+/*!
+ * @brief close the event fd
+*/
+StreamQueue::~StreamQueue() {
+    if (this->event_fd_ != -1) {
+        close(this->event_fd_);
+    }
+}
+
+/*!
+ * @brief queue a frame by the policy of its stream, called by the reading thread
+ * @param[in,out] frame received frame, moved in, its sequence is set here
+ * @return true=queued or dropped, false=stopped
+*/
+bool StreamQueue::Push(StreamFrame& frame) {
+    std::unique_lock<std::mutex> lock(this->mutex_streams_);
+
+    if (this->is_stopped_) {
+        return false;
+    }
+
+    // entries of a std::map stay in place, the answer slot keeps this one alive while waiting
+    auto iter = this->map_streams_.find(frame.stream_id);
+    if (iter == this->map_streams_.end()) {
+        iter = this->map_streams_.emplace(frame.stream_id, StreamEntry()).first;
+
+        auto iter_policy = this->map_policies_.find(frame.stream_id);
+        iter->second.policy = iter_policy == this->map_policies_.end() ? this->default_policy_ : iter_policy->second;
+    }
+    auto& entry = iter->second;
+
+    frame.sequence = entry.next_sequence++;
+    entry.deque_answers.emplace_back();
+    entry.deque_answers.back().sequence = frame.sequence;
+
+    size_t max_length = entry.policy == DropPolicy::LatestOnly ? 1 : this->max_queue_length_;
+
+    if (entry.policy == DropPolicy::Queue) {
+        // the socket backs the client up while the stream's queue is full
+        this->cv_popped_.wait(lock, [this, &entry, max_length] {
+            return this->is_stopped_ || entry.deque_frames.size() < max_length;
+        });
+
+        if (this->is_stopped_) {
+            return false;
+        }
+    } else {
+        while (entry.deque_frames.size() >= max_length) {
+            StreamFrame frame_dropped = std::move(entry.deque_frames.front());
+            entry.deque_frames.pop_front();
+            this->frame_count_--;
+
+            this->Drop(entry, frame_dropped);
+        }
+    }
+
+    entry.deque_frames.push_back(std::move(frame));
+    this->frame_count_++;
+    lock.unlock();
+
+    this->cv_pushed_.notify_one();
+    return true;
+}
+
+/*!
+ * @brief wait for a frame to process, streams with waiting frames take turns, called by the processing thread
+ * @param[out] frame frame to process
+ * @return true=got a frame, false=stopped
+*/
+bool StreamQueue::Pop(StreamFrame& frame) {
+    std::unique_lock<std::mutex> lock(this->mutex_streams_);
+    this->cv_pushed_.wait(lock, [this] { return this->is_stopped_ || this->frame_count_ > 0; });
+
+    if (this->is_stopped_) {
+        return false;
+    }
+
+    // the first stream after the last one served, wrapping around
+    auto iter = this->map_streams_.upper_bound(this->last_stream_id_);
+    while (true) {
+        if (iter == this->map_streams_.end()) {
+            iter = this->map_streams_.begin();
+        }
+        if (!iter->second.deque_frames.empty()) {
+            break;
+        }
+        ++iter;
+    }
+
+    frame = std::move(iter->second.deque_frames.front());
+    iter->second.deque_frames.pop_front();
+    this->frame_count_--;
+    this->last_stream_id_ = iter->first;
+    lock.unlock();
+
+    this->cv_popped_.notify_all();
+    return true;
+}
+
+/*!
+ * @brief hand back the processed images of a frame, called by the processing thread
+ * @param[in] frame processed frame
+ * @param[in,out] vector_mat_image images to send back, moved out
+*/
+void StreamQueue::Complete(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image) {
+    vector<vector<unsigned char>> vector_encoded;
+    this->Complete(frame, vector_mat_image, vector_encoded);
+}
+
+/*!
+ * @brief hand back the processed images of a frame together with their encoding, called by an encoding thread
+ * @param[in] frame processed frame
+ * @param[in,out] vector_mat_image images to send back, moved out
+ * @param[in,out] vector_encoded vector_mat_image encoded, moved out
+*/
+void StreamQueue::Complete(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image,
+                           vector<vector<unsigned char>>& vector_encoded) {
+    std::lock_guard<std::mutex> lockGuard(this->mutex_streams_);
+
+    auto iter = this->map_streams_.find(frame.stream_id);
+    if (iter == this->map_streams_.end()) {
+        return;
+    }
+
+    StreamAnswer answer;
+    answer.stream_id = frame.stream_id;
+    answer.content_type = frame.content_type;
+    answer.vector_mat_image = std::move(vector_mat_image);
+    answer.vector_encoded = std::move(vector_encoded);
+
+    this->SetReady(iter->second, frame.sequence, std::move(answer));
+}
+
+/*!
+ * @brief take the answers which can be written now, each stream's answers in the order of its frames,
+ *        called by the reading thread when the event fd is readable
+ * @param[out] vector_answers answers to write
+*/
+void StreamQueue::TakeAnswers(vector<StreamAnswer>& vector_answers) {
+    vector_answers.clear();
+
+    std::lock_guard<std::mutex> lockGuard(this->mutex_streams_);
+
+    // reset the event fd, answers set ready from now on post it again
+    uint64_t value;
+    while (read(this->event_fd_, &value, sizeof(value)) > 0) {
+    }
+
+    for (auto iter = this->map_streams_.begin(); iter != this->map_streams_.end();) {
+        auto& entry = iter->second;
+
+        while (!entry.deque_answers.empty() && entry.deque_answers.front().is_ready) {
+            vector_answers.push_back(std::move(entry.deque_answers.front().answer));
+            entry.deque_answers.pop_front();
+        }
+
+        if (entry.deque_answers.empty() && entry.deque_frames.empty()) {
+            iter = this->map_streams_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+}
+
+/*!
+ * @brief check whether a frame is not answered yet
+ * @return true=answers are pending
+*/
+bool StreamQueue::HasPendingAnswers() {
+    std::lock_guard<std::mutex> lockGuard(this->mutex_streams_);
+
+    for (const auto& item : this->map_streams_) {
+        if (!item.second.deque_answers.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief wait until an answer can be taken, for transports the reading thread can not poll
+*/
+void StreamQueue::WaitAnswers() {
+    std::unique_lock<std::mutex> lock(this->mutex_streams_);
+
+    this->cv_answered_.wait(lock, [this] {
+        if (this->is_stopped_) {
+            return true;
+        }
+
+        for (const auto& item : this->map_streams_) {
+            const auto& deque_answers = item.second.deque_answers;
+            if (!deque_answers.empty() && deque_answers.front().is_ready) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+/*!
+ * @brief wake every waiting thread, Push() and Pop() return false from now on
+*/
+void StreamQueue::Stop() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_streams_);
+        this->is_stopped_ = true;
+    }
+    this->cv_pushed_.notify_all();
+    this->cv_popped_.notify_all();
+    this->cv_answered_.notify_all();
+}
+
+/*!
+ * @brief get the fd which is readable while answers are ready
+ * @return event fd
+*/
+int StreamQueue::GetEventFd() const {
+    return this->event_fd_;
+}
+
+/*!
+ * @brief answer a frame as dropped
+ * @param[in,out] entry stream of the frame
+ * @param[in] frame dropped frame
+*/
+void StreamQueue::Drop(StreamEntry& entry, StreamFrame& frame) {
+    StreamAnswer answer;
+    answer.stream_id = frame.stream_id;
+    answer.content_type = frame.content_type;
+    answer.is_dropped = true;
+
+    this->SetReady(entry, frame.sequence, std::move(answer));
+}
+
+/*!
+ * @brief fill the answer slot of a frame, called with mutex_streams_ held
+ * @param[in,out] entry stream of the frame
+ * @param[in] sequence sequence of the frame
+ * @param[in] answer answer of the frame
+*/
+void StreamQueue::SetReady(StreamEntry& entry, long sequence, StreamAnswer&& answer) {
+    for (auto& slot : entry.deque_answers) {
+        if (slot.sequence == sequence) {
+            slot.answer = std::move(answer);
+            slot.is_ready = true;
+            break;
+        }
+    }
+
+    // nothing to write until the oldest answer of the stream is ready
+    if (!entry.deque_answers.empty() && entry.deque_answers.front().is_ready) {
+        this->Notify();
+    }
+}
+
+/*!
+ * @brief post the event fd and wake WaitAnswers()
+*/
+void StreamQueue::Notify() {
+    uint64_t value = 1;
+    if (write(this->event_fd_, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("Error: eventfd write");
+    }
+
+    this->cv_answered_.notify_all();
+}
@@ -0,0 +1,146 @@
+#ifndef SERVER_STREAM_QUEUE_H
+#define SERVER_STREAM_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+using namespace std;
+
+// what a stream does with a frame arriving while earlier frames of the stream still wait to be processed
+enum class DropPolicy : int {
+    // keep every frame, reading stops while the stream's queue is full
+    Queue = 0,
+    // drop the oldest waiting frame to make room
+    DropOldest = 1,
+    // keep only the newest frame, the waiting one is dropped
+    LatestOnly = 2
+};
+
+// a received frame, its content is copied out of the Message so the next frame can be read meanwhile
+struct StreamFrame {
+    long stream_id = 0;
+
+    // order of the frame in its stream, answers are written in this order
+    long sequence = 0;
+
+    string content_type;
+
+    // "priority" of the frame
+    string priority;
+
+    // encoded images of "binary/image" and "binary/image-batch"
+    vector<vector<unsigned char>> vector_encoded;
+
+    // pixels of "binary/mat"
+    cv::Mat mat_raw;
+
+    // encoding of the answer when the reading thread does not encode it, as the Message did when the frame arrived
+    string format;
+
+    vector<int> imencode_params;
+};
+
+// answer to a frame, processed images or a dropped notice
+struct StreamAnswer {
+    long stream_id = 0;
+
+    string content_type;
+
+    vector<cv::Mat> vector_mat_image;
+
+    // vector_mat_image already encoded, written as they are, empty when the reading thread encodes them
+    vector<vector<unsigned char>> vector_encoded;
+
+    bool is_dropped = false;
+};
+
+
+// frames of the streams of one connection between the thread reading the socket and the thread processing them,
+// each stream keeps its own queue and drop policy, answers leave in the order their frames arrived
+class StreamQueue {
+
+public:
+    StreamQueue(DropPolicy default_policy, const map<long, DropPolicy>& map_policies, int max_queue_length);
+
+    ~StreamQueue();
+
+    bool Push(StreamFrame& frame);
+
+    bool Pop(StreamFrame& frame);
+
+    void Complete(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image);
+
+    void Complete(const StreamFrame& frame, vector<cv::Mat>& vector_mat_image,
+                  vector<vector<unsigned char>>& vector_encoded);
+
+    void TakeAnswers(vector<StreamAnswer>& vector_answers);
+
+    bool HasPendingAnswers();
+
+    void WaitAnswers();
+
+    void Stop();
+
+    int GetEventFd() const;
+
+private:
+
+    struct AnswerSlot {
+        long sequence = 0;
+        bool is_ready = false;
+        StreamAnswer answer;
+    };
+
+    struct StreamEntry {
+        DropPolicy policy = DropPolicy::Queue;
+
+        long next_sequence = 0;
+
+        // frames waiting to be processed, oldest first
+        deque<StreamFrame> deque_frames;
+
+        // one slot per frame not answered yet, in arrival order
+        deque<AnswerSlot> deque_answers;
+    };
+
+    DropPolicy default_policy_;
+
+    map<long, DropPolicy> map_policies_;
+
+    long max_queue_length_;
+
+    // streams with frames or answers in flight, a stream without either is removed
+    map<long, StreamEntry> map_streams_;
+
+    // count of frames waiting in every stream
+    long frame_count_ = 0;
+
+    // stream of the last popped frame, streams take turns after it
+    long last_stream_id_ = -1;
+
+    bool is_stopped_ = false;
+
+    mutex mutex_streams_;
+
+    condition_variable cv_pushed_;
+
+    condition_variable cv_popped_;
+
+    condition_variable cv_answered_;
+
+    // readable while answers are ready, polled together with the socket by the reading thread
+    int event_fd_ = -1;
+
+    void Drop(StreamEntry& entry, StreamFrame& frame);
+
+    void SetReady(StreamEntry& entry, long sequence, StreamAnswer&& answer);
+
+    void Notify();
+};
+
+#endif //SERVER_STREAM_QUEUE_H
@@ -5,10 +5,10 @@ using namespace std;
 
 
 int main() {
-    cout << "socket server is starting..." << endl;
+    LOG_INFO("socket server is starting...");
 
     string host1 = "0.0.0.0";
-    Server server = Server(host1, 65432, 10);
+    Server server(host1, 65432, 10);
     server.Start();
 
     return 0;
@@ -0,0 +1,263 @@
+#include "tls_session.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <poll.h>
+
+#ifdef USE_KTLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+    /*!
+     * @brief log and clear the error queue of OpenSSL
+     * @param[in] action what failed
+    */
+    void LogSslErrors(const string& action) {
+        char error_text[256];
+
+        unsigned long error_code = ERR_get_error();
+        if (error_code == 0) {
+            LOG_WARNING(action << " failed");
+        }
+
+        for (; error_code != 0; error_code = ERR_get_error()) {
+            ERR_error_string_n(error_code, error_text, sizeof(error_text));
+            LOG_WARNING(action << " failed, " << error_text);
+        }
+    }
+}
+#endif
+
+/*!
+ * @brief create the context of a Server or a Client
+ * @param[in] options certificates of this side and the CA of the peer
+ * @param[in] is_server true=accepts connections, false=connects
+ * @return context, nullptr if a file can not be loaded or the build lacks USE_KTLS
+*/
+shared_ptr<TlsContext> TlsContext::Create(const TlsOptions& options, bool is_server) {
+#ifdef USE_KTLS
+    shared_ptr<TlsContext> tls_context(new TlsContext());
+    tls_context->is_server_ = is_server;
+    tls_context->server_name_ = options.server_name;
+
+    auto ssl_ctx = SSL_CTX_new(is_server ? TLS_server_method() : TLS_client_method());
+    if (ssl_ctx == nullptr) {
+        LogSslErrors("SSL_CTX_new");
+        return nullptr;
+    }
+    tls_context->ssl_ctx_ = ssl_ctx;
+
+    SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+
+    // ciphers the kernel can take over
+    SSL_CTX_set_cipher_list(ssl_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_ciphersuites(ssl_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+
+    // frames carry their length, a peer closing without close_notify is a closed connection, not a truncation
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    // a session ticket after the handshake would arrive as a record recv() of kTLS can not take
+    if (is_server) {
+        SSL_CTX_set_num_tickets(ssl_ctx, 0);
+    }
+
+    if (!options.cert_path.empty() &&
+        (SSL_CTX_use_certificate_chain_file(ssl_ctx, options.cert_path.c_str()) != 1 ||
+         SSL_CTX_use_PrivateKey_file(ssl_ctx, options.key_path.c_str(), SSL_FILETYPE_PEM) != 1 ||
+         SSL_CTX_check_private_key(ssl_ctx) != 1)) {
+        LogSslErrors("loading " + options.cert_path + " and " + options.key_path);
+        return nullptr;
+    }
+
+    if (!options.ca_path.empty()) {
+        if (SSL_CTX_load_verify_locations(ssl_ctx, options.ca_path.c_str(), nullptr) != 1) {
+            LogSslErrors("loading " + options.ca_path);
+            return nullptr;
+        }
+        SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | (is_server ? SSL_VERIFY_FAIL_IF_NO_PEER_CERT : 0), nullptr);
+    } else if (!is_server) {
+        LOG_WARNING("no CA given, the certificate of the server is not verified");
+    }
+
+    return tls_context;
+#else
+    (void) options;
+    (void) is_server;
+    LOG_ERROR("TLS is not built, configure with -DUSE_KTLS=ON");
+    return nullptr;
+#endif
+}
+
+/*!
+ * @brief free the OpenSSL context
+*/
+TlsContext::~TlsContext() {
+#ifdef USE_KTLS
+    SSL_CTX_free(this->ssl_ctx_);
+#endif
+}
+
+/*!
+ * @brief check whether sessions of this context accept connections
+ * @return true=server, false=client
+*/
+bool TlsContext::IsServer() const {
+    return this->is_server_;
+}
+
+/*!
+ * @brief get the name a client checks the server's certificate against
+ * @return name, empty = not checked
+*/
+const string& TlsContext::GetServerName() const {
+    return this->server_name_;
+}
+
+/*!
+ * @brief get the OpenSSL context
+ * @return SSL_CTX
+*/
+ssl_ctx_st* TlsContext::GetHandle() const {
+    return this->ssl_ctx_;
+}
+
+/*!
+ * @brief init TlsSession of a connected socket
+ * @param[in] tls_context context of the Server or the Client
+ * @param[in] socket_fd tcp socket
+*/
+TlsSession::TlsSession(const shared_ptr<TlsContext>& tls_context, int socket_fd) {
+    this->tls_context_ = tls_context;
+    this->socket_fd_ = socket_fd;
+}
+
+/*!
+ * @brief free the OpenSSL session, the socket stays open
+*/
+TlsSession::~TlsSession() {
+#ifdef USE_KTLS
+    SSL_free(this->ssl_);
+#endif
+}
+
+/*!
+ * @brief run the handshake, then hand the records to the kernel where it takes them
+ * @return true=succeed, false=failed
+*/
+bool TlsSession::Handshake() {
+#ifdef USE_KTLS
+    this->ssl_ = SSL_new(this->tls_context_->GetHandle());
+    if (this->ssl_ == nullptr || SSL_set_fd(this->ssl_, this->socket_fd_) != 1) {
+        LogSslErrors("SSL_new");
+        return false;
+    }
+
+    const auto& server_name = this->tls_context_->GetServerName();
+    if (!this->tls_context_->IsServer() && !server_name.empty()) {
+        SSL_set_tlsext_host_name(this->ssl_, server_name.c_str());
+        SSL_set1_host(this->ssl_, server_name.c_str());
+    }
+
+    int result = this->tls_context_->IsServer() ? SSL_accept(this->ssl_) : SSL_connect(this->ssl_);
+    if (result != 1) {
+        LogSslErrors("TLS handshake");
+        return false;
+    }
+
+    // OpenSSL sets up kTLS on its own during the handshake when SSL_OP_ENABLE_KTLS is set
+    this->is_kernel_send_ = BIO_get_ktls_send(SSL_get_wbio(this->ssl_)) == 1;
+    this->is_kernel_recv_ = BIO_get_ktls_recv(SSL_get_rbio(this->ssl_)) == 1;
+
+    LOG_INFO(SSL_get_version(this->ssl_) << " " << SSL_get_cipher_name(this->ssl_) << ", records sent by "
+             << (this->is_kernel_send_ ? "kernel" : "OpenSSL") << ", received by "
+             << (this->is_kernel_recv_ ? "kernel" : "OpenSSL"));
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * @brief check whether the kernel encrypts what is written to the socket
+ * @return true=send() and sendmsg() of the socket, false=Write()
+*/
+bool TlsSession::IsKernelSend() const {
+    return this->is_kernel_send_;
+}
+
+/*!
+ * @brief check whether the kernel decrypts what is read from the socket
+ * @return true=recv() of the socket, false=Read()
+*/
+bool TlsSession::IsKernelRecv() const {
+    return this->is_kernel_recv_;
+}
+
+/*!
+ * @brief read and decrypt in user space, waiting for the socket without holding the writers back
+ * @param[out] buffer output buffer
+ * @param[in] length size of buffer
+ * @return count of bytes, 0 = closed, -1 = error
+*/
+long TlsSession::Read(void* buffer, long length) {
+#ifdef USE_KTLS
+    std::unique_lock<mutex> lock(this->mutex_ssl_);
+    while (!SSL_has_pending(this->ssl_)) {
+        lock.unlock();
+
+        struct pollfd poll_fd{this->socket_fd_, POLLIN, 0};
+        if (poll(&poll_fd, 1, -1) == -1 && errno != EINTR) {
+            return -1;
+        }
+
+        lock.lock();
+        if (poll_fd.revents != 0) {
+            break;
+        }
+    }
+
+    int result = SSL_read(this->ssl_, buffer, (int) std::min<long>(length, INT_MAX));
+    if (result > 0) {
+        return result;
+    }
+    return SSL_get_error(this->ssl_, result) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+#else
+    (void) buffer;
+    (void) length;
+    return -1;
+#endif
+}
+
+/*!
+ * @brief check for bytes OpenSSL has decrypted but Read() has not returned, poll() of the socket misses them
+ * @return true=Read() returns them without waiting for the socket
+*/
+bool TlsSession::HasPending() {
+#ifdef USE_KTLS
+    std::lock_guard<mutex> lock_guard(this->mutex_ssl_);
+    return this->ssl_ != nullptr && SSL_pending(this->ssl_) > 0;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * @brief encrypt in user space and write
+ * @param[in] buffer input buffer
+ * @param[in] length size of buffer
+ * @return count of bytes, every byte unless failed, -1 = error
+*/
+long TlsSession::Write(const void* buffer, long length) {
+#ifdef USE_KTLS
+    std::lock_guard<mutex> lock_guard(this->mutex_ssl_);
+    int result = SSL_write(this->ssl_, buffer, (int) std::min<long>(length, INT_MAX));
+    return result > 0 ? result : -1;
+#else
+    (void) buffer;
+    (void) length;
+    return -1;
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef SERVER_TLS_SESSION_H
+#define SERVER_TLS_SESSION_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// OpenSSL types, only tls_session.cpp includes OpenSSL
+struct ssl_ctx_st;
+struct ssl_st;
+
+
+// TLS of the tcp connections of a Server or a Client, certificates are PEM files, e.g. from make-test-cert.sh
+struct TlsOptions {
+    bool is_enabled = false;
+
+    // certificate chain and its key, a server needs both, a client only to authenticate itself
+    string cert_path;
+
+    string key_path;
+
+    // CA the peer's certificate must be signed by, empty = the peer is not verified
+    string ca_path;
+
+    // name the client expects in the server's certificate, empty = not checked
+    string server_name;
+};
+
+
+// OpenSSL context shared by the connections of a Server or a Client, built with USE_KTLS
+class TlsContext {
+
+public:
+    static shared_ptr<TlsContext> Create(const TlsOptions& options, bool is_server);
+
+    ~TlsContext();
+
+    bool IsServer() const;
+
+    const string& GetServerName() const;
+
+    ssl_ctx_st* GetHandle() const;
+
+private:
+    TlsContext() = default;
+
+    ssl_ctx_st* ssl_ctx_ = nullptr;
+
+    bool is_server_ = false;
+
+    string server_name_;
+};
+
+
+// TLS of one connection, after the handshake the kernel encrypts and decrypts the records (kTLS) so frames keep
+// going through send(), sendmsg() and recv() of the socket, OpenSSL does it in user space when the kernel can not
+class TlsSession {
+
+public:
+    TlsSession(const shared_ptr<TlsContext>& tls_context, int socket_fd);
+
+    ~TlsSession();
+
+    bool Handshake();
+
+    bool IsKernelSend() const;
+
+    bool IsKernelRecv() const;
+
+    long Read(void* buffer, long length);
+
+    bool HasPending();
+
+    long Write(const void* buffer, long length);
+
+private:
+    shared_ptr<TlsContext> tls_context_;
+
+    ssl_st* ssl_ = nullptr;
+
+    // an SSL object is not used by two threads at once, e.g. a live stream reads the next frame while answering
+    mutex mutex_ssl_;
+
+    int socket_fd_;
+
+    bool is_kernel_send_ = false;
+
+    bool is_kernel_recv_ = false;
+};
+
+#endif //SERVER_TLS_SESSION_H
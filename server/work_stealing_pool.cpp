@@ -0,0 +1,200 @@
+#include "work_stealing_pool.h"
+#include "cpu_topology.h"
+#include "logger.h"
+
+namespace {
+    // pool and index of the worker running on this thread, tasks it submits go to its own deque
+    thread_local WorkStealingPool* current_pool = nullptr;
+
+    thread_local int current_index = -1;
+}
+
+/*!
+ * @brief init WorkStealingPool and start its workers
+ * @param[in] thread_count count of workers
+ * @param[in] is_numa_pinned true=pin each worker to one cpu, spread over the NUMA nodes
+*/
+WorkStealingPool::WorkStealingPool(int thread_count, bool is_numa_pinned) {
+    thread_count = std::max(thread_count, 1);
+
+    // worker i belongs to node i % node count
+    auto vector_nodes = is_numa_pinned ? CpuTopology::GetNodeCpus() : vector<vector<int>>(1);
+    int node_count = (int) vector_nodes.size();
+
+    for (int i = 0; i < thread_count; i++) {
+        this->vector_workers_.emplace_back(new Worker());
+    }
+    this->SetVictims(node_count);
+
+    for (int i = 0; i < thread_count; i++) {
+        this->vector_threads_.emplace_back(&WorkStealingPool::WorkHandle, this, i);
+
+        if (is_numa_pinned) {
+            CpuTopology::PinThread(this->vector_threads_[i].native_handle(),
+                                   {CpuTopology::GetSpreadCpu(vector_nodes, i)});
+        }
+    }
+
+    if (is_numa_pinned) {
+        LOG_INFO(thread_count << " processing threads pinned over " << node_count << " NUMA nodes");
+    }
+}
+
+/*!
+ * @brief run the tasks still queued and stop the workers
+*/
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lockGuard(this->mutex_idle_);
+        this->is_stopped_ = true;
+    }
+    this->cv_idle_.notify_all();
+
+    for (auto& item : this->vector_threads_) {
+        item.join();
+    }
+}
+
+/*!
+ * @brief queue a task without waiting for it
+ * @param[in] hint e.g. the connection of the task, tasks of one hint start on the same worker
+ * @param[in] task task to run
+*/
+void WorkStealingPool::Submit(long hint, function<void()> task) {
+    // a worker keeps the tasks it spawns, they are likely to use what is in its cache
+    int index = current_pool == this ? current_index : (int) ((unsigned long) hint % this->vector_workers_.size());
+
+    auto& worker = *this->vector_workers_[index];
+    {
+        std::lock_guard<std::mutex> lockGuard(worker.mutex_tasks);
+        worker.deque_tasks.push_back(std::move(task));
+    }
+
+    // the shared mutex is only taken to wake a sleeping worker, one going to sleep sees the count first
+    this->pending_count_++;
+    if (this->idle_count_ > 0) {
+        { std::lock_guard<std::mutex> lockGuard(this->mutex_idle_); }
+        this->cv_idle_.notify_one();
+    }
+}
+
+/*!
+ * @brief run a job on the pool and wait for it, a worker calling this runs the job itself
+ * @param[in] hint e.g. the connection of the job
+ * @param[in] job job to run
+*/
+void WorkStealingPool::Run(long hint, const function<void()>& job) {
+    if (current_pool == this) {
+        job();
+        return;
+    }
+
+    mutex mutex_done;
+    condition_variable cv_done;
+    bool is_done = false;
+
+    this->Submit(hint, [&job, &mutex_done, &cv_done, &is_done]() {
+        job();
+
+        std::lock_guard<std::mutex> lockGuard(mutex_done);
+        is_done = true;
+        cv_done.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex_done);
+    cv_done.wait(lock, [&is_done] { return is_done; });
+}
+
+/*!
+ * @brief get count of workers
+ * @return count of workers
+*/
+int WorkStealingPool::GetThreadCount() const {
+    return (int) this->vector_workers_.size();
+}
+
+/*!
+ * @brief take the newest task of a worker, or steal the oldest task of another one
+ * @param[in] index index of the worker
+ * @param[out] task task to run
+ * @return true=got a task
+*/
+bool WorkStealingPool::TryTake(int index, function<void()>& task) {
+    auto& worker = *this->vector_workers_[index];
+    {
+        std::lock_guard<std::mutex> lockGuard(worker.mutex_tasks);
+        if (!worker.deque_tasks.empty()) {
+            task = std::move(worker.deque_tasks.back());
+            worker.deque_tasks.pop_back();
+            this->pending_count_--;
+            return true;
+        }
+    }
+
+    for (int victim_index : worker.vector_victims) {
+        auto& victim = *this->vector_workers_[victim_index];
+
+        std::lock_guard<std::mutex> lockGuard(victim.mutex_tasks);
+        if (!victim.deque_tasks.empty()) {
+            task = std::move(victim.deque_tasks.front());
+            victim.deque_tasks.pop_front();
+            this->pending_count_--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * @brief worker thread, runs tasks until the pool stops and every deque is empty
+ * @param[in] index index of the worker
+*/
+void WorkStealingPool::WorkHandle(int index) {
+    current_pool = this;
+    current_index = index;
+
+    function<void()> task;
+
+    while (true) {
+        if (this->TryTake(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(this->mutex_idle_);
+        this->idle_count_++;
+        this->cv_idle_.wait(lock, [this] { return this->is_stopped_ || this->pending_count_ > 0; });
+        this->idle_count_--;
+
+        if (this->is_stopped_ && this->pending_count_ == 0) {
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief choose the steal order of each worker, workers of its own node first
+ * @param[in] node_count count of NUMA nodes the workers are spread over
+*/
+void WorkStealingPool::SetVictims(int node_count) {
+    int worker_count = (int) this->vector_workers_.size();
+
+    for (int i = 0; i < worker_count; i++) {
+        int node = i % node_count;
+
+        // start after this worker, so workers do not all rob the same victim
+        auto& vector_victims = this->vector_workers_[i]->vector_victims;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int k = 1; k < worker_count; k++) {
+                int victim_index = (i + k) % worker_count;
+                bool is_same_node = victim_index % node_count == node;
+
+                if (is_same_node == (pass == 0)) {
+                    vector_victims.push_back(victim_index);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef SERVER_WORK_STEALING_POOL_H
+#define SERVER_WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+// thread pool with one task deque per worker, a worker runs its own newest task first and steals the oldest
+// task of another worker when it runs dry, so submitting threads do not meet on one shared queue
+class WorkStealingPool {
+
+public:
+    WorkStealingPool(int thread_count, bool is_numa_pinned);
+
+    ~WorkStealingPool();
+
+    void Submit(long hint, function<void()> task);
+
+    void Run(long hint, const function<void()>& job);
+
+    int GetThreadCount() const;
+
+private:
+
+    struct Worker {
+        mutex mutex_tasks;
+
+        deque<function<void()>> deque_tasks;
+
+        // other workers in the order this one steals from them, workers of the same NUMA node first
+        vector<int> vector_victims;
+    };
+
+    vector<unique_ptr<Worker>> vector_workers_;
+
+    vector<thread> vector_threads_;
+
+    // count of tasks in every deque
+    atomic<long> pending_count_{0};
+
+    // count of workers sleeping on cv_idle_
+    atomic<int> idle_count_{0};
+
+    bool is_stopped_ = false;
+
+    // idle workers sleep here until a task is submitted
+    mutex mutex_idle_;
+
+    condition_variable cv_idle_;
+
+    bool TryTake(int index, function<void()>& task);
+
+    void WorkHandle(int index);
+
+    void SetVictims(int node_count);
+};
+
+#endif //SERVER_WORK_STEALING_POOL_H